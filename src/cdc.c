@@ -0,0 +1,46 @@
+#include "cdc.h"
+
+// bits of the hash that have to be zero for a cut in front of and behind CDC_AVG
+#define BITS_SMALL (18)
+#define BITS_LARGE (14)
+
+static uint64_t mix(uint64_t *x);
+
+void cdc_init(struct cdc *cdc, uint64_t seed) {
+	for ( int i = 0; i < 256; i++ )
+		cdc->gear[i] = mix(&seed);
+}
+
+size_t cdc_cut(const struct cdc *cdc, const uint8_t *p, size_t len) {
+	uint64_t h   = 0;
+	size_t   i   = CDC_MIN;
+	size_t   avg = len < CDC_AVG ? len : CDC_AVG;
+	size_t   max = len < CDC_MAX ? len : CDC_MAX;
+
+	if ( len <= CDC_MIN )
+		return len;
+
+	// every byte shifts the older ones one bit further out. the top bits cover the last 64.
+	for ( ; i < avg; i++ ) {
+		h = (h << 1) + cdc->gear[p[i]];
+		if ( !(h >> (64 - BITS_SMALL)) )
+			return i + 1;
+	}
+
+	for ( ; i < max; i++ ) {
+		h = (h << 1) + cdc->gear[p[i]];
+		if ( !(h >> (64 - BITS_LARGE)) )
+			return i + 1;
+	}
+
+	return max;
+}
+
+// splitmix64
+static uint64_t mix(uint64_t *x) {
+	uint64_t z = (*x += UINT64_C(0x9e3779b97f4a7c15));
+
+	z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+	z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+	return z ^ (z >> 31);
+}
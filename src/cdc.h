@@ -0,0 +1,26 @@
+#ifndef _NACL_CRYPT_CDC_H
+#define _NACL_CRYPT_CDC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// content defined chunking with a gear hash. a cut depends only on the 64 bytes in front
+// of it, so an edit moves the cuts next to it and all other chunks stay the same. cuts
+// are rare before CDC_AVG and frequent after it, most chunks end up close to it.
+#define CDC_MIN (16 * 1024)
+#define CDC_AVG (64 * 1024)
+#define CDC_MAX (256 * 1024)
+
+// the gear decides where the cuts are. a secret seed keeps the chunk lengths from
+// telling anything about the data.
+typedef struct cdc {
+	uint64_t gear[256];
+} cdc_t;
+
+void   cdc_init(struct cdc *cdc, uint64_t seed);
+
+// length of the chunk at the start of len bytes of p. unless p holds all that is left
+// of the input len has to be CDC_MAX at least.
+size_t cdc_cut(const struct cdc *cdc, const uint8_t *p, size_t len);
+
+#endif /* _NACL_CRYPT_CDC_H */
@@ -40,7 +40,19 @@ static const char schema[] =
 	"    AFTER DELETE ON PrivateKeys FOR EACH ROW\n"
 	"    WHEN OLD.NameId NOT IN ( SELECT NameId FROM PrivateKeys ) BEGIN\n"
 	"        DELETE FROM Names WHERE Names.Id = OLD.NameId;\n"
-	"END;\n";
+	"END;\n"
+
+	"CREATE TABLE IF NOT EXISTS Chunks (\n"
+	"    Id    BLOB PRIMARY KEY CHECK ( LENGTH(Id) = %" PRIu32 " ),\n"
+	"    Refs  INTEGER NOT NULL CHECK ( Refs > 0 ),\n"
+	"    Chunk BLOB NOT NULL\n"
+	");\n"
+
+	"CREATE TABLE IF NOT EXISTS Snapshots (\n"
+	"    Id       INTEGER PRIMARY KEY ASC AUTOINCREMENT,\n"
+	"    Name     STRING NOT NULL UNIQUE,\n"
+	"    Manifest BLOB NOT NULL\n"
+	");\n";
 
 static const char select_pk[] =
 	"SELECT PublicKeys.PublicKey FROM PublicKeys\n"
@@ -78,6 +90,9 @@ static const char foreign_keys_on[] =
 static const char begin_exclusive[] =
 	"BEGIN EXCLUSIVE TRANSACTION;";
 
+static const char begin_deferred[] =
+	"BEGIN TRANSACTION;";
+
 static const char commit_transaction[] =
 	"COMMIT TRANSACTION;";
 
@@ -126,6 +141,38 @@ static const char count_sk[] =
 	"SELECT COUNT(*) FROM Names, PrivateKeys\n"
 	"    WHERE Names.Name = ? AND Names.Id = PrivateKeys.NameId;";
 
+static const char select_chunk[] =
+	"SELECT Chunks.Chunk FROM Chunks\n"
+	"    WHERE Chunks.Id = ?;";
+
+static const char ref_chunk_query[] =
+	"UPDATE Chunks SET Refs = Refs + 1\n"
+	"    WHERE Chunks.Id = ?;";
+
+static const char insert_chunk[] =
+	"INSERT INTO Chunks ( Id, Refs, Chunk )\n"
+	"    VALUES ( ?, 1, ? );";
+
+static const char unref_chunk_query[] =
+	"UPDATE Chunks SET Refs = Refs - 1\n"
+	"    WHERE Chunks.Id = ? AND Chunks.Refs > 1;";
+
+static const char delete_chunk[] =
+	"DELETE FROM Chunks\n"
+	"    WHERE Chunks.Id = ? AND Chunks.Refs = 1;";
+
+static const char select_snapshot[] =
+	"SELECT Snapshots.Manifest FROM Snapshots\n"
+	"    WHERE Snapshots.Name = ?;";
+
+static const char insert_snapshot[] =
+	"INSERT INTO Snapshots ( Id, Name, Manifest )\n"
+	"    VALUES ( NULL, ?, ? );";
+
+static const char delete_snapshot[] =
+	"DELETE FROM Snapshots\n"
+	"    WHERE Snapshots.Name = ?;";
+
 static const char schema_failed[]         = "Failed to define schema";
 static const char open_failed[]           = "Failed to open database";
 static const char close_failed[]          = "Failed to close database";
@@ -168,6 +215,11 @@ static const char select_all_failed[]          = "Failed to select all key mater
 static const char count_pk_failed[]            = "Failed to count public keys by name";
 static const char count_sk_failed[]            = "Faield to count private keys by name";
 
+static const char prepare_store_failed[]       = "Failed to prepare statement for the chunk store";
+static const char bind_store_failed[]          = "Failed to bind parameter to statement for the chunk store";
+static const char step_store_failed[]          = "Failed to step through statement for the chunk store";
+static const char transaction_failed[]         = "Failed to begin or end transaction for the chunk store";
+
 static enum rc get(const char *restrict name, const char *restrict query, int query_len, struct sk *restrict sk, struct pk *restrict pk);
 static enum rc put(const char *restrict name, bool replace, const struct sk *restrict sk, const struct pk *restrict pk);
 static enum rc del(const char *restrict name, bool force, bool sk, bool pk);
@@ -175,12 +227,31 @@ static void explode(sqlite3_stmt *stmt, const char *restrict msg);
 static void explode2(sqlite3_stmt **stmts, const char *restrict msg);
 static void *memcpy_or_zero(void *restrict dst, const void *restrict src, size_t n);
 
+// the chunk store runs the same few statements for every chunk. they are prepared once.
+enum store_stmt {
+	SELECT_CHUNK    = 0,
+	REF_CHUNK       = 1,
+	INSERT_CHUNK    = 2,
+	UNREF_CHUNK     = 3,
+	DELETE_CHUNK    = 4,
+	SELECT_SNAPSHOT = 5,
+	INSERT_SNAPSHOT = 6,
+	DELETE_SNAPSHOT = 7,
+	STORE_STATEMENT_COUNT = 8
+};
+
+static sqlite3_stmt *store[STORE_STATEMENT_COUNT];
+
+static sqlite3_stmt *store_stmt(enum store_stmt i);
+static enum rc       step_store(sqlite3_stmt *stmt);
+static enum rc       get_blob(sqlite3_stmt *stmt, void **blob, size_t *len);
+
 
 enum rc define_schema() {
 	char *err = NULL;
-	char buf[strlen(schema) + sizeof('\0') + 2 * CHARS_PER_UINT32];
+	char buf[strlen(schema) + sizeof('\0') + 3 * CHARS_PER_UINT32];
 	
-	if ( snprintf(buf, sizeof(buf), schema, crypto_box_PUBLICKEYBYTES, crypto_box_SECRETKEYBYTES) < 0 ) {
+	if ( snprintf(buf, sizeof(buf), schema, crypto_box_PUBLICKEYBYTES, crypto_box_SECRETKEYBYTES, CHUNK_ID_LENGTH) < 0 ) {
     	sqlite3_close(db);
 		fprintf(stderr, "%s.\n", prepare_schema_failed);
 		exit(70);
@@ -257,6 +328,9 @@ enum rc open_db(const char *restrict db_path) {
 }
 
 void close_db() {
+	for ( int i = 0; i < STORE_STATEMENT_COUNT; i++ )
+		sqlite3_finalize(store[i]);
+
 	if ( sqlite3_close(db) != SQLITE_OK ) {
 		fprintf(stderr, "%s: %s\n", close_failed, sqlite3_errmsg(db));
 		exit(70);
@@ -311,6 +385,195 @@ enum rc del_kp(const char *restrict name, bool force) {
 	return del(name, force, true, true);
 }
 
+enum rc begin_store(bool write) {
+	char *err = NULL;
+
+	switch ( sqlite3_exec(db, write ? begin_exclusive : begin_deferred, NULL, NULL, &err) ) {
+		case SQLITE_OK:
+			return OK;
+
+		case SQLITE_LOCKED:
+			sqlite3_free(err);
+			return DB_LOCKED;
+
+		case SQLITE_BUSY:
+			sqlite3_free(err);
+			return DB_BUSY;
+
+		default:
+			fprintf(stderr, "%s: %s\n", transaction_failed, err);
+			sqlite3_free(err);
+			sqlite3_close(db);
+			exit(70);
+	}
+}
+
+enum rc end_store(bool commit) {
+	char *err = NULL;
+
+	switch ( sqlite3_exec(db, commit ? commit_transaction : rollback_transaction, NULL, NULL, &err) ) {
+		case SQLITE_OK:
+			return OK;
+
+		case SQLITE_LOCKED:
+			sqlite3_free(err);
+			return DB_LOCKED;
+
+		case SQLITE_BUSY:
+			sqlite3_free(err);
+			return DB_BUSY;
+
+		default:
+			fprintf(stderr, "%s: %s\n", transaction_failed, err);
+			sqlite3_free(err);
+			sqlite3_close(db);
+			exit(70);
+	}
+}
+
+enum rc ref_chunk(const uint8_t *restrict id) {
+	sqlite3_stmt *stmt = store_stmt(REF_CHUNK);
+	enum rc       rc;
+
+	if ( sqlite3_bind_blob(stmt, 1, id, CHUNK_ID_LENGTH, SQLITE_STATIC) != SQLITE_OK )
+		explode(stmt, bind_store_failed);
+
+	if ( (rc = step_store(stmt)) != OK )
+		return rc;
+	return sqlite3_changes(db) ? OK : NOT_FOUND;
+}
+
+enum rc add_chunk(const uint8_t *restrict id, const void *restrict c, size_t len) {
+	sqlite3_stmt *stmt = store_stmt(INSERT_CHUNK);
+
+	if ( sqlite3_bind_blob(stmt, 1, id, CHUNK_ID_LENGTH, SQLITE_STATIC) != SQLITE_OK || sqlite3_bind_blob(stmt, 2, c, len, SQLITE_STATIC) != SQLITE_OK )
+		explode(stmt, bind_store_failed);
+
+	return step_store(stmt);
+}
+
+enum rc get_chunk(const uint8_t *restrict id, void **c, size_t *len) {
+	sqlite3_stmt *stmt = store_stmt(SELECT_CHUNK);
+
+	if ( sqlite3_bind_blob(stmt, 1, id, CHUNK_ID_LENGTH, SQLITE_STATIC) != SQLITE_OK )
+		explode(stmt, bind_store_failed);
+
+	return get_blob(stmt, c, len);
+}
+
+enum rc unref_chunk(const uint8_t *restrict id) {
+	sqlite3_stmt *stmt = store_stmt(UNREF_CHUNK);
+	enum rc       rc;
+
+	if ( sqlite3_bind_blob(stmt, 1, id, CHUNK_ID_LENGTH, SQLITE_STATIC) != SQLITE_OK )
+		explode(stmt, bind_store_failed);
+
+	if ( (rc = step_store(stmt)) != OK || sqlite3_changes(db) )
+		return rc;
+
+	// the last reference goes with the chunk
+	stmt = store_stmt(DELETE_CHUNK);
+	if ( sqlite3_bind_blob(stmt, 1, id, CHUNK_ID_LENGTH, SQLITE_STATIC) != SQLITE_OK )
+		explode(stmt, bind_store_failed);
+
+	if ( (rc = step_store(stmt)) != OK )
+		return rc;
+	return sqlite3_changes(db) ? OK : NOT_FOUND;
+}
+
+enum rc add_snapshot(const char *restrict name, const void *restrict m, size_t len) {
+	sqlite3_stmt *stmt = store_stmt(INSERT_SNAPSHOT);
+
+	if ( sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC) != SQLITE_OK || sqlite3_bind_blob(stmt, 2, m, len, SQLITE_STATIC) != SQLITE_OK )
+		explode(stmt, bind_store_failed);
+
+	return step_store(stmt);
+}
+
+enum rc get_snapshot(const char *restrict name, void **m, size_t *len) {
+	sqlite3_stmt *stmt = store_stmt(SELECT_SNAPSHOT);
+
+	if ( sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC) != SQLITE_OK )
+		explode(stmt, bind_store_failed);
+
+	return get_blob(stmt, m, len);
+}
+
+enum rc del_snapshot(const char *restrict name) {
+	sqlite3_stmt *stmt = store_stmt(DELETE_SNAPSHOT);
+	enum rc       rc;
+
+	if ( sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC) != SQLITE_OK )
+		explode(stmt, bind_store_failed);
+
+	if ( (rc = step_store(stmt)) != OK )
+		return rc;
+	return sqlite3_changes(db) ? OK : NOT_DELETED;
+}
+
+static sqlite3_stmt *store_stmt(enum store_stmt i) {
+	const char *restrict queries[] = {
+		select_chunk, ref_chunk_query, insert_chunk, unref_chunk_query, delete_chunk,
+		select_snapshot, insert_snapshot, delete_snapshot
+	};
+
+	if ( !store[i] && sqlite3_prepare_v2(db, queries[i], strlen(queries[i]) + sizeof('\0'), &store[i], NULL) != SQLITE_OK )
+		explode(store[i], prepare_store_failed);
+
+	sqlite3_reset(store[i]);
+	sqlite3_clear_bindings(store[i]);
+	return store[i];
+}
+
+// OK once done, NOT_STORED if a constraint got in the way
+static enum rc step_store(sqlite3_stmt *stmt) {
+	switch ( sqlite3_step(stmt) ) {
+		case SQLITE_DONE:
+			return OK;
+
+		case SQLITE_CONSTRAINT:
+			return NOT_STORED;
+
+		case SQLITE_LOCKED:
+			return DB_LOCKED;
+
+		case SQLITE_BUSY:
+			return DB_BUSY;
+
+		default:
+			explode(stmt, step_store_failed);
+			return NOT_STORED;
+	}
+}
+
+static enum rc get_blob(sqlite3_stmt *stmt, void **blob, size_t *len) {
+	switch ( sqlite3_step(stmt) ) {
+		case SQLITE_ROW: {
+			const void *b = sqlite3_column_blob(stmt, 0);
+			const int   n = sqlite3_column_bytes(stmt, 0);
+
+			if ( !(*blob = malloc(n ? n : 1)) )
+				explode(stmt, step_store_failed);
+			memcpy(*blob, b, n);
+			*len = n;
+			return OK;
+		}
+
+		case SQLITE_DONE:
+			return NOT_FOUND;
+
+		case SQLITE_LOCKED:
+			return DB_LOCKED;
+
+		case SQLITE_BUSY:
+			return DB_BUSY;
+
+		default:
+			explode(stmt, step_store_failed);
+			return NOT_FOUND;
+	}
+}
+
 static void explode(sqlite3_stmt *stmt, const char *restrict msg) {
 	sqlite3_finalize(stmt);
 	fprintf(stderr, "%s: %s\n", msg, sqlite3_errmsg(db));
@@ -30,4 +30,23 @@ enum rc del_kp(const char *restrict name, bool force);
 
 enum rc list_kp(list_f callback);
 
+// the chunk store. a chunk is found by a keyed hash of its plaintext and counted once for
+// every reference from a snapshot. a snapshot is a sealed manifest under a name. all of
+// it happens between begin_store and end_store.
+enum rc begin_store(bool write);
+enum rc end_store(bool commit);
+
+// OK if the chunk is there and referred to once more
+enum rc ref_chunk(const uint8_t *restrict id);
+enum rc add_chunk(const uint8_t *restrict id, const void *restrict c, size_t len);
+// *c is the caller's to free
+enum rc get_chunk(const uint8_t *restrict id, void **c, size_t *len);
+// one reference less. the last one takes the chunk along.
+enum rc unref_chunk(const uint8_t *restrict id);
+
+// NOT_STORED if the name is taken
+enum rc add_snapshot(const char *restrict name, const void *restrict m, size_t len);
+enum rc get_snapshot(const char *restrict name, void **m, size_t *len);
+enum rc del_snapshot(const char *restrict name);
+
 #endif /* NACL_CRYPT_DB_H */
@@ -10,6 +10,9 @@
 #define HDR_MAC(x) (((x)->hdr) + NONCE_LENGTH)
 #define HDR_KEY(x) (((x)->hdr) + NONCE_LENGTH + MAC_LENGTH)
 
+#define WRAP_NONCE(x) ((x)->wrap)
+#define WRAP_BOX(x) (((x)->wrap) + NONCE_LENGTH)
+
 void init_hdr(struct hdr *restrict hdr) {
 	void *nonce = HDR_NONCE(hdr);
 	void *key   = HDR_KEY(hdr);
@@ -55,3 +58,129 @@ int dec_hdr(struct hdr *restrict hdr, const struct pk *restrict pk, const struct
 	
 	return 0;
 }
+
+void init_key(uint8_t *restrict k) {
+	randombytes(k, KEY_LENGTH);
+}
+
+void init_pre(struct pre *restrict pre, unsigned flags, unsigned log_bs, unsigned recipients) {
+	memcpy(pre->pre, MAGIC, MAGIC_LENGTH);
+	PRE_VERSION(pre)    = VERSION;
+	PRE_FLAGS(pre)      = flags;
+	PRE_LOG_BS(pre)     = log_bs;
+	PRE_RECIPIENTS(pre) = recipients;
+}
+
+// the version is checked by the caller. an unknown one may still be an old header.
+bool is_pre(const struct pre *restrict pre) {
+	return memcmp(pre->pre, MAGIC, MAGIC_LENGTH) == 0;
+}
+
+// derive what every box between pk and sk shares. the rest of a box is a secretbox.
+int box_key(struct bk *restrict bk, const struct pk *restrict pk, const struct sk *restrict sk) {
+	return crypto_box_beforenm(bk->bk, pk->pk, sk->sk);
+}
+
+// box k for one recipient. the preamble is boxed along so nobody can change it unnoticed.
+int wrap_key(struct wrap *restrict wrap, const uint8_t *restrict k, const struct pre *restrict pre, const struct pk *restrict pk, const struct sk *restrict sk) {
+	struct bk bk;
+
+	if ( box_key(&bk, pk, sk) ) return -1;
+	return wrap_key_bk(wrap, k, pre, &bk);
+}
+
+int wrap_key_bk(struct wrap *restrict wrap, const uint8_t *restrict k, const struct pre *restrict pre, const struct bk *restrict bk) {
+	uint8_t       m[crypto_box_ZEROBYTES + KEY_LENGTH + PRE_LENGTH];
+	uint8_t       c[crypto_box_ZEROBYTES + KEY_LENGTH + PRE_LENGTH];
+	uint8_t      *n = WRAP_NONCE(wrap);
+	const size_t  l = sizeof(m);
+	int           r;
+
+	randombytes(n, NONCE_LENGTH);
+	memset(m, 0, crypto_box_ZEROBYTES);
+	memcpy(m + crypto_box_ZEROBYTES, k, KEY_LENGTH);
+	memcpy(m + crypto_box_ZEROBYTES + KEY_LENGTH, pre->pre, PRE_LENGTH);
+
+	if ( (r = crypto_box_afternm(c, m, l, n, bk->bk)) ) return r;
+	memcpy(WRAP_BOX(wrap), c + crypto_box_BOXZEROBYTES, sizeof(c) - crypto_box_BOXZEROBYTES);
+
+	return 0;
+}
+
+int unwrap_key(uint8_t *restrict k, const struct wrap *restrict wrap, const struct pre *restrict pre, const struct pk *restrict pk, const struct sk *restrict sk) {
+	struct bk bk;
+
+	if ( box_key(&bk, pk, sk) ) return -1;
+	return unwrap_key_bk(k, wrap, pre, &bk);
+}
+
+int unwrap_key_bk(uint8_t *restrict k, const struct wrap *restrict wrap, const struct pre *restrict pre, const struct bk *restrict bk) {
+	uint8_t       m[crypto_box_ZEROBYTES + KEY_LENGTH + PRE_LENGTH];
+	uint8_t       c[crypto_box_ZEROBYTES + KEY_LENGTH + PRE_LENGTH];
+	const uint8_t *n = WRAP_NONCE(wrap);
+	const size_t  l = sizeof(m);
+	int           r;
+
+	memset(c, 0, crypto_box_BOXZEROBYTES);
+	memcpy(c + crypto_box_BOXZEROBYTES, WRAP_BOX(wrap), sizeof(c) - crypto_box_BOXZEROBYTES);
+
+	if ( (r = crypto_box_open_afternm(m, c, l, n, bk->bk)) ) return r;
+	if ( memcmp(m + crypto_box_ZEROBYTES + KEY_LENGTH, pre->pre, PRE_LENGTH) ) return -1;
+	memcpy(k, m + crypto_box_ZEROBYTES, KEY_LENGTH);
+
+	return 0;
+}
+
+// box len bytes of m for one recipient into COMPACT_LENGTH(len) bytes of c. one random
+// nonce and one crypto_box() for the whole message. the preamble is boxed along.
+int box_msg(uint8_t *restrict c, const uint8_t *restrict m, size_t len, const struct pre *restrict pre, const struct pk *restrict pk, const struct sk *restrict sk) {
+	struct bk bk;
+
+	if ( box_key(&bk, pk, sk) ) return -1;
+	return box_msg_bk(c, m, len, pre, &bk);
+}
+
+int box_msg_bk(uint8_t *restrict c, const uint8_t *restrict m, size_t len, const struct pre *restrict pre, const struct bk *restrict bk) {
+	uint8_t bm[crypto_box_ZEROBYTES + PRE_LENGTH + COMPACT_MAX];
+	uint8_t bc[crypto_box_ZEROBYTES + PRE_LENGTH + COMPACT_MAX];
+	int     r;
+
+	if ( len > COMPACT_MAX )
+		return -1;
+
+	randombytes(c, NONCE_LENGTH);
+	memset(bm, 0, crypto_box_ZEROBYTES);
+	memcpy(bm + crypto_box_ZEROBYTES, pre->pre, PRE_LENGTH);
+	memcpy(bm + crypto_box_ZEROBYTES + PRE_LENGTH, m, len);
+
+	if ( (r = crypto_box_afternm(bc, bm, crypto_box_ZEROBYTES + PRE_LENGTH + len, c, bk->bk)) ) return r;
+	memcpy(c + NONCE_LENGTH, bc + crypto_box_BOXZEROBYTES, MAC_LENGTH + PRE_LENGTH + len);
+
+	return 0;
+}
+
+// open len bytes of c into len - COMPACT_LENGTH(0) bytes of m
+int unbox_msg(uint8_t *restrict m, const uint8_t *restrict c, size_t len, const struct pre *restrict pre, const struct pk *restrict pk, const struct sk *restrict sk) {
+	struct bk bk;
+
+	if ( box_key(&bk, pk, sk) ) return -1;
+	return unbox_msg_bk(m, c, len, pre, &bk);
+}
+
+int unbox_msg_bk(uint8_t *restrict m, const uint8_t *restrict c, size_t len, const struct pre *restrict pre, const struct bk *restrict bk) {
+	uint8_t bm[crypto_box_ZEROBYTES + PRE_LENGTH + COMPACT_MAX];
+	uint8_t bc[crypto_box_ZEROBYTES + PRE_LENGTH + COMPACT_MAX];
+	int     r;
+
+	if ( len < COMPACT_LENGTH(0) || len > COMPACT_LENGTH(COMPACT_MAX) )
+		return -1;
+
+	memset(bc, 0, crypto_box_BOXZEROBYTES);
+	memcpy(bc + crypto_box_BOXZEROBYTES, c + NONCE_LENGTH, len - NONCE_LENGTH);
+
+	if ( (r = crypto_box_open_afternm(bm, bc, crypto_box_BOXZEROBYTES + len - NONCE_LENGTH, c, bk->bk)) ) return r;
+	if ( memcmp(bm + crypto_box_ZEROBYTES, pre->pre, PRE_LENGTH) ) return -1;
+	memcpy(m, bm + crypto_box_ZEROBYTES + PRE_LENGTH, len - COMPACT_LENGTH(0));
+
+	return 0;
+}
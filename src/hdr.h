@@ -3,8 +3,28 @@
 
 #include "types.h"
 
+#define PRE_VERSION(x)    (((x)->pre)[MAGIC_LENGTH + 0])
+#define PRE_FLAGS(x)      (((x)->pre)[MAGIC_LENGTH + 1])
+#define PRE_LOG_BS(x)     (((x)->pre)[MAGIC_LENGTH + 2])
+#define PRE_RECIPIENTS(x) (((x)->pre)[MAGIC_LENGTH + 3])
+
 void init_hdr(struct hdr *restrict hdr);
 int  enc_hdr(struct hdr *restrict hdr, const struct pk *restrict pk, const struct sk *restrict sk);
 int  dec_hdr(struct hdr *restrict hdr, const struct pk *restrict pk, const struct sk *restrict sk);
 
+void init_key(uint8_t *restrict k);
+void init_pre(struct pre *restrict pre, unsigned flags, unsigned log_bs, unsigned recipients);
+bool is_pre(const struct pre *restrict pre);
+int  box_key(struct bk *restrict bk, const struct pk *restrict pk, const struct sk *restrict sk);
+int  wrap_key(struct wrap *restrict wrap, const uint8_t *restrict k, const struct pre *restrict pre, const struct pk *restrict pk, const struct sk *restrict sk);
+int  unwrap_key(uint8_t *restrict k, const struct wrap *restrict wrap, const struct pre *restrict pre, const struct pk *restrict pk, const struct sk *restrict sk);
+int  box_msg(uint8_t *restrict c, const uint8_t *restrict m, size_t len, const struct pre *restrict pre, const struct pk *restrict pk, const struct sk *restrict sk);
+int  unbox_msg(uint8_t *restrict m, const uint8_t *restrict c, size_t len, const struct pre *restrict pre, const struct pk *restrict pk, const struct sk *restrict sk);
+
+// the same with what box_key derived once for a pair of keys
+int  wrap_key_bk(struct wrap *restrict wrap, const uint8_t *restrict k, const struct pre *restrict pre, const struct bk *restrict bk);
+int  unwrap_key_bk(uint8_t *restrict k, const struct wrap *restrict wrap, const struct pre *restrict pre, const struct bk *restrict bk);
+int  box_msg_bk(uint8_t *restrict c, const uint8_t *restrict m, size_t len, const struct pre *restrict pre, const struct bk *restrict bk);
+int  unbox_msg_bk(uint8_t *restrict m, const uint8_t *restrict c, size_t len, const struct pre *restrict pre, const struct bk *restrict bk);
+
 #endif /* _NACL_CRYPT_HDR_H */
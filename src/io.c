@@ -0,0 +1,464 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#define READ_AHEAD (8 * 1024 * 1024)
+#define PIPE_SIZE  (1024 * 1024)
+
+static int  open_file(struct output *out, const char *path, const char *name, int flags, bool splice);
+static void advance(struct iovec **iov, int *n, size_t len);
+#ifdef __linux__
+static void setup_splice(struct output *out);
+static int  pump(struct output *out, size_t len);
+#endif
+
+int open_input(struct input *in, const char *path, bool map) {
+	struct stat st;
+
+	memset(in, 0, sizeof(*in));
+	if ( !path ) {
+		off_t off;
+
+		// a file on standard input can still be addressed. it is read, not mapped.
+		in->name = "standard input";
+		in->fd   = STDIN_FILENO;
+		if ( fstat(in->fd, &st) == 0 && S_ISREG(st.st_mode) && (off = lseek(in->fd, 0, SEEK_CUR)) != -1 ) {
+			in->regular = true;
+			in->size    = st.st_size;
+			in->off     = off;
+		}
+		return 0;
+	}
+
+	in->name = path;
+	if ( (in->fd = open(path, O_RDONLY)) == -1 )
+		return -1;
+
+	if ( fstat(in->fd, &st) == 0 && S_ISREG(st.st_mode) ) {
+		in->regular = true;
+		in->size    = st.st_size;
+		in->mapped  = map;
+		if ( map && in->size != 0 ) {
+			void *map = mmap(NULL, in->size, PROT_READ, MAP_SHARED, in->fd, 0);
+			if ( map == MAP_FAILED ) {
+				close(in->fd);
+				return -1;
+			}
+			in->map = map;
+			posix_madvise(map, in->size, POSIX_MADV_SEQUENTIAL);
+		}
+	}
+
+	return 0;
+}
+
+void close_input(struct input *in) {
+	if ( in->map )
+		munmap((void *) in->map, in->size);
+	if ( in->fd != STDIN_FILENO )
+		close(in->fd);
+}
+
+// read until len bytes arrived or the input ended. pipes hand out short reads.
+size_t read_input(struct input *in, void *buf, size_t len) {
+	size_t j = 0;
+
+	if ( in->pull ) {
+		j        = in->pull(in, buf, len);
+		in->off += j;
+		return j;
+	}
+
+	if ( !in->mapped ) {
+		while ( j < len && !in->eof ) {
+			ssize_t r = read(in->fd, (uint8_t *) buf + j, len - j);
+			if ( r > 0 )
+				j += r;
+			else if ( r == 0 )
+				in->eof = true;
+			else if ( errno != EINTR ) {
+				in->failed = true;
+				break;
+			}
+		}
+		in->off += j;
+		return j;
+	}
+
+	if ( len > in->size - in->off )
+		len = in->size - in->off;
+
+	// keep the kernel reading ahead of the copy
+	if ( in->off + len > in->advised && in->advised < in->size ) {
+		size_t ahead = in->size - in->advised < READ_AHEAD ? in->size - in->advised : READ_AHEAD;
+		posix_madvise((void *) (in->map + in->advised), ahead, POSIX_MADV_WILLNEED);
+		in->advised += ahead;
+	}
+
+	memcpy(buf, in->map + in->off, len);
+	in->off += len;
+	return len;
+}
+
+// wait up to timeout ms for input and take what a single read(2) hands out.
+// a negative timeout waits as long as it takes. returns 0 if nothing arrived.
+size_t poll_input(struct input *in, void *buf, size_t len, int timeout) {
+	struct pollfd p = { .fd = in->fd, .events = POLLIN };
+	ssize_t       r;
+
+	if ( in->eof || in->failed )
+		return 0;
+
+	if ( (r = poll(&p, 1, timeout)) <= 0 ) {
+		if ( r < 0 && errno != EINTR )
+			in->failed = true;
+		return 0;
+	}
+
+	while ( (r = read(in->fd, buf, len)) < 0 && errno == EINTR )
+		;
+
+	if ( r > 0 ) {
+		in->off += r;
+		return r;
+	}
+
+	if ( r == 0 )
+		in->eof = true;
+	else
+		in->failed = true;
+	return 0;
+}
+
+// positioned read of a regular file. returns less than len at the end of the file.
+size_t read_input_at(struct input *in, void *buf, size_t len, uint64_t off) {
+	size_t j = 0;
+
+	while ( j < len ) {
+		ssize_t r = pread(in->fd, (uint8_t *) buf + j, len - j, off + j);
+		if ( r > 0 )
+			j += r;
+		else if ( r == 0 )
+			break;
+		else if ( errno != EINTR ) {
+			in->failed = true;
+			break;
+		}
+	}
+
+	return j;
+}
+
+// move a regular file len bytes ahead. reading continues from there.
+int skip_input(struct input *in, uint64_t len) {
+	if ( !in->regular )
+		return -1;
+
+	if ( in->off > in->size )
+		len = 0;
+	else if ( len > in->size - in->off )
+		len = in->size - in->off;
+
+	if ( !in->mapped && lseek(in->fd, in->off + len, SEEK_SET) == -1 )
+		return -1;
+
+	in->off += len;
+	return 0;
+}
+
+bool input_eof(const struct input *in) {
+	return in->mapped ? in->off == in->size : in->eof;
+}
+
+int open_output(struct output *out, const char *path, bool splice) {
+	return open_file(out, path, path, O_TRUNC, splice);
+}
+
+// path.new is written instead of path. a file of that name that is already there is left
+// alone and the open fails.
+int open_replacement(struct output *out, const char *path, bool splice) {
+	char tmp[strlen(path) + sizeof(".new")];
+
+	strcpy(tmp, path);
+	strcat(tmp, ".new");
+	return open_file(out, tmp, path, O_EXCL, splice);
+}
+
+// path.new takes the place of path. it only needs to reach the disk first if there is
+// something a crash could take away.
+int finish_replacement(struct output *out, const char *path) {
+	char tmp[strlen(path) + sizeof(".new")];
+
+	strcpy(tmp, path);
+	strcat(tmp, ".new");
+	if ( access(path, F_OK) == 0 && sync_output(out) )
+		return -1;
+
+	return rename(tmp, path);
+}
+
+// path.new is removed, path is left as it was
+void drop_replacement(const char *path) {
+	char tmp[strlen(path) + sizeof(".new")];
+
+	strcpy(tmp, path);
+	strcat(tmp, ".new");
+	unlink(tmp);
+}
+
+// an existing file to be changed in place with write_output_at. nothing is truncated.
+int reopen_output(struct output *out, const char *path) {
+	memset(out, 0, sizeof(*out));
+	out->pipe  = -1;
+	out->drain = -1;
+	out->name  = path;
+	if ( (out->fd = open(path, O_WRONLY)) == -1 )
+		return -1;
+
+	out->regular = true;
+	return 0;
+}
+
+// continue writing at off. whatever is there is overwritten.
+int seek_output(struct output *out, uint64_t off) {
+	if ( lseek(out->fd, off, SEEK_SET) == -1 )
+		return -1;
+
+	out->off     = off;
+	out->written = 0;
+	return 0;
+}
+
+int close_output(struct output *out) {
+	if ( out->pipe != -1 ) {
+		close(out->pipe);
+		close(out->drain);
+	}
+
+	int rc = 0;
+	if ( out->seek && lseek(out->fd, out->off + out->written, SEEK_SET) == -1 )
+		rc = -1;
+	if ( out->fd != STDOUT_FILENO && close(out->fd) )
+		rc = -1;
+
+	return rc;
+}
+
+// write all of iov. the vector is consumed on the way.
+int write_output(struct output *out, struct iovec *iov, int n) {
+	while ( n > 0 ) {
+		ssize_t w = writev(out->fd, iov, n);
+		if ( w < 0 ) {
+			if ( errno == EINTR )
+				continue;
+			return -1;
+		}
+
+		out->written += w;
+		advance(&iov, &n, w);
+	}
+
+	return 0;
+}
+
+// positioned write to a regular file. safe from several threads at once.
+// the caller keeps track of the file offset and of written.
+int write_output_at(struct output *out, const void *buf, size_t len, uint64_t off) {
+	while ( len > 0 ) {
+		ssize_t w = pwrite(out->fd, buf, len, off);
+		if ( w < 0 ) {
+			if ( errno == EINTR )
+				continue;
+			return -1;
+		}
+
+		buf  = (const uint8_t *) buf + w;
+		len -= w;
+		off += w;
+	}
+
+	return 0;
+}
+
+// allocate len bytes behind everything written so far. only a full disk is an error,
+// file systems without fallocate(2) are fine.
+int reserve_output(struct output *out, uint64_t len) {
+	int err = posix_fallocate(out->fd, out->off + out->written, len);
+
+	return err == ENOSPC || err == EFBIG ? -1 : 0;
+}
+
+// cut off whatever was reserved or written out of order behind the written bytes
+int truncate_output(struct output *out) {
+	return ftruncate(out->fd, out->off + out->written);
+}
+
+int sync_output(struct output *out) {
+	return fdatasync(out->fd);
+}
+
+// write buf to path as a whole. a crash leaves either the old or the new file behind.
+int replace_file(const char *path, const void *buf, size_t len) {
+	struct output out;
+	char          tmp[strlen(path) + sizeof(".new")];
+
+	memset(&out, 0, sizeof(out));
+	strcpy(tmp, path);
+	strcat(tmp, ".new");
+	if ( (out.fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1 )
+		return -1;
+
+	if ( write_output_at(&out, buf, len, 0) || fsync(out.fd) ) {
+		close(out.fd);
+		unlink(tmp);
+		return -1;
+	}
+
+	if ( close(out.fd) || rename(tmp, path) ) {
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+// map iov into the output pipe. anything else is reached through an internal pipe and splice(2).
+int splice_output(struct output *out, struct iovec *iov, int n) {
+#ifdef __linux__
+	if ( !out->splice )
+		return write_output(out, iov, n);
+
+	int fd = out->pipe != -1 ? out->pipe : out->fd;
+	while ( n > 0 ) {
+		ssize_t w = vmsplice(fd, iov, n, 0);
+		if ( w < 0 ) {
+			if ( errno == EINTR )
+				continue;
+			return -1;
+		}
+
+		if ( out->pipe != -1 && pump(out, w) )
+			return -1;
+
+		out->written += w;
+		advance(&iov, &n, w);
+	}
+
+	return 0;
+#else
+	return write_output(out, iov, n);
+#endif
+}
+
+static int open_file(struct output *out, const char *path, const char *name, int flags, bool splice) {
+	struct stat st;
+	int         fl;
+	off_t       off;
+
+	memset(out, 0, sizeof(*out));
+	out->pipe  = -1;
+	out->drain = -1;
+
+	if ( !path ) {
+		out->name = "standard output";
+		out->fd   = STDOUT_FILENO;
+	} else {
+		out->name = name;
+		if ( (out->fd = open(path, O_WRONLY | O_CREAT | flags, 0600)) == -1 )
+			return -1;
+	}
+
+	// appending writers can't be addressed by offset
+	if ( fstat(out->fd, &st) == 0 && S_ISREG(st.st_mode) && (fl = fcntl(out->fd, F_GETFL)) != -1 && !(fl & O_APPEND) && (off = lseek(out->fd, 0, SEEK_CUR)) != -1 ) {
+		out->regular = true;
+		out->off     = off;
+	}
+
+#ifdef __linux__
+	if ( splice )
+		setup_splice(out);
+#endif
+
+	return 0;
+}
+
+static void advance(struct iovec **iov, int *n, size_t len) {
+	while ( *n > 0 && len >= (*iov)->iov_len ) {
+		len -= (*iov)->iov_len;
+		(*iov)++;
+		(*n)--;
+	}
+
+	if ( *n > 0 ) {
+		(*iov)->iov_base  = (uint8_t *) (*iov)->iov_base + len;
+		(*iov)->iov_len  -= len;
+	}
+}
+
+#ifdef __linux__
+// pages in a pipe are released once the reader consumed them. the pipe never holds more than
+// its size, so a buffer is free again after that many bytes followed it. a socket may keep
+// pages referenced from its send buffer as well. splice(2) into a regular file copies.
+static void setup_splice(struct output *out) {
+	struct stat st;
+	int         fl;
+	int         p[2];
+	int         size;
+
+	if ( fstat(out->fd, &st) || (fl = fcntl(out->fd, F_GETFL)) == -1 || (fl & O_APPEND) )
+		return;
+
+	if ( S_ISFIFO(st.st_mode) ) {
+		fcntl(out->fd, F_SETPIPE_SZ, PIPE_SIZE);
+		if ( (size = fcntl(out->fd, F_GETPIPE_SZ)) <= 0 )
+			return;
+		out->hold = size;
+	} else if ( S_ISREG(st.st_mode) || S_ISSOCK(st.st_mode) ) {
+		if ( pipe(p) )
+			return;
+		fcntl(p[1], F_SETPIPE_SZ, PIPE_SIZE);
+		out->drain = p[0];
+		out->pipe  = p[1];
+
+		if ( S_ISSOCK(st.st_mode) ) {
+			int       sndbuf = 0;
+			socklen_t len    = sizeof(sndbuf);
+
+			getsockopt(out->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len);
+			out->hold = sndbuf > 0 ? sndbuf : 0;
+		}
+	} else {
+		return;
+	}
+
+	out->splice = true;
+}
+
+static int pump(struct output *out, size_t len) {
+	while ( len > 0 ) {
+		ssize_t w = splice(out->drain, NULL, out->fd, NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+		if ( w < 0 ) {
+			if ( errno == EINTR )
+				continue;
+			return -1;
+		}
+		if ( w == 0 )
+			return -1;
+		len -= w;
+	}
+
+	return 0;
+}
+#endif
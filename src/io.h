@@ -0,0 +1,66 @@
+#ifndef _NACL_CRYPT_IO_H
+#define _NACL_CRYPT_IO_H
+
+#include "types.h"
+
+#include <sys/uio.h>
+
+// block source. regular files are mapped and copied straight from the page cache
+// unless the caller reads them at their offsets itself. an input with pull set is
+// read through it instead. it fills the buffer and sets eof and failed like a pipe.
+typedef struct input {
+	const char    *name;
+	int            fd;
+	size_t       (*pull)(struct input *in, void *buf, size_t len);
+	void          *arg;
+	const uint8_t *map;
+	size_t         size;
+	size_t         off;
+	size_t         advised;
+	bool           regular;
+	bool           mapped;
+	bool           eof;
+	bool           failed;
+} input_t;
+
+// block sink. with splice set, block buffers are handed to the kernel by vmsplice(2)
+// and must stay untouched until hold more bytes have been written after them.
+// regular files may be written at off + n instead. set seek to move the file offset
+// behind all of it once the output is closed.
+typedef struct output {
+	const char    *name;
+	int            fd;
+	int            pipe;
+	int            drain;
+	bool           splice;
+	bool           regular;
+	bool           seek;
+	size_t         hold;
+	uint64_t       off;
+	uint64_t       written;
+} output_t;
+
+int    open_input(struct input *in, const char *path, bool map);
+void   close_input(struct input *in);
+size_t read_input(struct input *in, void *buf, size_t len);
+size_t poll_input(struct input *in, void *buf, size_t len, int timeout);
+size_t read_input_at(struct input *in, void *buf, size_t len, uint64_t off);
+int    skip_input(struct input *in, uint64_t len);
+bool   input_eof(const struct input *in);
+
+int    open_output(struct output *out, const char *path, bool splice);
+int    open_replacement(struct output *out, const char *path, bool splice);
+int    finish_replacement(struct output *out, const char *path);
+void   drop_replacement(const char *path);
+int    reopen_output(struct output *out, const char *path);
+int    seek_output(struct output *out, uint64_t off);
+int    close_output(struct output *out);
+int    write_output(struct output *out, struct iovec *iov, int n);
+int    write_output_at(struct output *out, const void *buf, size_t len, uint64_t off);
+int    reserve_output(struct output *out, uint64_t len);
+int    truncate_output(struct output *out);
+int    sync_output(struct output *out);
+int    replace_file(const char *path, const void *buf, size_t len);
+int    splice_output(struct output *out, struct iovec *iov, int n);
+
+#endif /* _NACL_CRYPT_IO_H */
@@ -0,0 +1,154 @@
+#include "lz.h"
+
+#include <string.h>
+
+#define MIN_MATCH  (4)
+#define MAX_OFFSET (65535)
+#define HASH_LOG   (14)
+#define SKIP_LOG   (6)
+
+static uint8_t *put_seq(uint8_t *o, const uint8_t *o_end, const uint8_t *lit, size_t n, size_t off, size_t m);
+static uint8_t *put_len(uint8_t *o, size_t n);
+static int      get_len(const uint8_t *src, size_t len, size_t *i, size_t *n);
+static uint32_t read32(const uint8_t *p);
+static unsigned hash(uint32_t v);
+
+size_t lz_pack(uint8_t *restrict dst, size_t cap, const uint8_t *restrict src, size_t len) {
+	uint32_t  table[1 << HASH_LOG];
+	size_t    i      = 0;
+	size_t    anchor = 0;
+	uint8_t  *o      = dst;
+
+	memset(table, 0, sizeof(table));
+
+	while ( i < len && len - i >= MIN_MATCH ) {
+		uint32_t  v = read32(src + i);
+		uint32_t *t = &table[hash(v)];
+		size_t    r = *t;
+
+		*t = i;
+		if ( r >= i || i - r > MAX_OFFSET || read32(src + r) != v ) {
+			// the longer nothing matched the faster the data is skipped
+			i += 1 + ((i - anchor) >> SKIP_LOG);
+			continue;
+		}
+
+		size_t m = MIN_MATCH;
+		while ( i + m < len && src[r + m] == src[i + m] )
+			m++;
+		while ( i > anchor && r > 0 && src[i - 1] == src[r - 1] ) {
+			i--;
+			r--;
+			m++;
+		}
+
+		if ( !(o = put_seq(o, dst + cap, src + anchor, i - anchor, i - r, m)) )
+			return 0;
+		i     += m;
+		anchor = i;
+	}
+
+	if ( anchor < len && !(o = put_seq(o, dst + cap, src + anchor, len - anchor, 0, 0)) )
+		return 0;
+
+	return o - dst;
+}
+
+int lz_unpack(uint8_t *restrict dst, size_t cap, const uint8_t *restrict src, size_t len, size_t *out) {
+	size_t i = 0;
+	size_t j = 0;
+
+	while ( i < len ) {
+		unsigned token = src[i++];
+		size_t   n     = token >> 4;
+		size_t   m     = token & 15;
+
+		if ( n == 15 && get_len(src, len, &i, &n) )
+			return -1;
+		if ( n > len - i || n > cap - j )
+			return -1;
+		memcpy(dst + j, src + i, n);
+		i += n;
+		j += n;
+
+		if ( i == len )
+			break;
+		if ( len - i < 2 )
+			return -1;
+
+		size_t off = src[i] | (size_t) src[i + 1] << 8;
+		i += 2;
+		if ( m == 15 && get_len(src, len, &i, &m) )
+			return -1;
+		m += MIN_MATCH;
+		if ( off == 0 || off > j || m > cap - j )
+			return -1;
+
+		// a short offset repeats a pattern. every copy doubles what can be copied at once.
+		for ( size_t k = 0, d = off; k < m; d = k + off ) {
+			size_t c = d < m - k ? d : m - k;
+			memcpy(dst + j + k, dst + j + k - d, c);
+			k += c;
+		}
+		j += m;
+	}
+
+	*out = j;
+	return 0;
+}
+
+static uint8_t *put_seq(uint8_t *o, const uint8_t *o_end, const uint8_t *lit, size_t n, size_t off, size_t m) {
+	size_t ml = m ? m - MIN_MATCH : 0;
+
+	if ( (size_t) (o_end - o) < 1 + n / 255 + 1 + n + 2 + ml / 255 + 1 )
+		return NULL;
+
+	*o++ = (n < 15 ? n : 15) << 4 | (ml < 15 ? ml : 15);
+	if ( n >= 15 )
+		o = put_len(o, n - 15);
+	memcpy(o, lit, n);
+	o += n;
+
+	if ( m ) {
+		*o++ = off;
+		*o++ = off >> 8;
+		if ( ml >= 15 )
+			o = put_len(o, ml - 15);
+	}
+
+	return o;
+}
+
+static uint8_t *put_len(uint8_t *o, size_t n) {
+	while ( n >= 255 ) {
+		*o++  = 255;
+		n    -= 255;
+	}
+	*o++ = n;
+
+	return o;
+}
+
+static int get_len(const uint8_t *src, size_t len, size_t *i, size_t *n) {
+	uint8_t b;
+
+	do {
+		if ( *i == len )
+			return -1;
+		b   = src[(*i)++];
+		*n += b;
+	} while ( b == 255 );
+
+	return 0;
+}
+
+static uint32_t read32(const uint8_t *p) {
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static unsigned hash(uint32_t v) {
+	return (v * UINT32_C(2654435761)) >> (32 - HASH_LOG);
+}
@@ -0,0 +1,17 @@
+#ifndef _NACL_CRYPT_LZ_H
+#define _NACL_CRYPT_LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// byte oriented LZ77 in the style of LZ4. a sequence is a token with the literal and
+// match length in its nibbles, more length bytes if a nibble is full, the literals,
+// and a two byte little endian offset. the last sequence has no match.
+
+// pack len bytes of src into at most cap bytes of dst. returns 0 if they don't fit.
+size_t lz_pack(uint8_t *restrict dst, size_t cap, const uint8_t *restrict src, size_t len);
+
+// unpack len bytes of src into at most cap bytes of dst. anything malformed fails.
+int    lz_unpack(uint8_t *restrict dst, size_t cap, const uint8_t *restrict src, size_t len, size_t *out);
+
+#endif /* _NACL_CRYPT_LZ_H */
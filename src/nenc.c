@@ -13,8 +13,6 @@
 #include <ctype.h>
 
 
-#define BS (131072)
-
 static int start_db();
 
 int main(int argc, char **argv) {
@@ -37,6 +37,30 @@ int dispatch() {
 		case DECRYPT:
 			exit_code = decrypt();
 			break;
+
+		case INSPECT:
+			exit_code = inspect();
+			break;
+
+		case VERIFY:
+			exit_code = verify();
+			break;
+
+		case REWRAP:
+			exit_code = rewrap();
+			break;
+
+		case UPDATE:
+			exit_code = update();
+			break;
+
+		case FORGET:
+			exit_code = forget();
+			break;
+
+		case QUERY:
+			exit_code = query();
+			break;
 		
 		default:
 			fprintf(stderr, "Unsupported operation.\n");
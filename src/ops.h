@@ -9,5 +9,11 @@ int delete_key();
 int list_keys();
 int encrypt();
 int decrypt();
+int inspect();
+int verify();
+int rewrap();
+int update();
+int forget();
+int query();
 
 #endif /* _NACLCRYPT_OPS_H */
@@ -1,46 +1,806 @@
+#include "cdc.h"
 #include "db.h"
+#include "io.h"
+#include "lz.h"
 #include "ops.h"
 #include "opts.h"
 #include "hdr.h"
+#include "stream.h"
 #include "types.h"
+#include "vfs.h"
 
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
-#define BS (131072)
+#include <crypto_hash.h>
+#include <crypto_secretbox.h>
+#include <randombytes.h>
+#include <sqlite3.h>
+
+// blocks done, bytes written, size and modification time of the input
+#define CHECKPOINT_LENGTH (32)
+
+// what a checkpoint is written from. the header holds the data key wrapped for the
+// recipients, the record is boxed for the first one.
+struct checkpoint {
+	const uint8_t   *head;
+	size_t           head_len;
+	const struct pk *pk;
+	const struct sk *sk;
+	uint64_t         size;
+	uint64_t         mtime;
+};
+
+// an archive holds its members one after another, then the index and the length of the
+// index. an entry of the index is offset, length, modification time in ns, mode and path.
+#define ENTRY_LENGTH (30)
+#define INDEX_TAIL   (8)
+#define MEMBER_PATH  (4096)
+
+struct member {
+	uint64_t    off;
+	uint64_t    len;
+	uint64_t    mtime;
+	uint32_t    mode;
+	const char *path;
+	size_t      path_len;
+};
+
+// the files named in the list are read one after the other. the index grows on the way.
+struct archive {
+	struct input *list;
+	struct input  file;
+	bool          reading;
+	bool          done;
+	int           exit_code;
+	uint64_t      off;
+	uint64_t      mtime;
+	uint32_t      mode;
+	uint8_t      *index;
+	size_t        index_len;
+	size_t        index_cap;
+	size_t        sent;
+	uint8_t       buf[4096];
+	size_t        pos;
+	size_t        end;
+	char          path[MEMBER_PATH];
+	size_t        path_len;
+};
+
+// a file of a batch and where it goes. dev and ino tell the same input under two names.
+struct batch_file {
+	char     *in;
+	char     *out;
+	uint64_t  size;
+	dev_t     dev;
+	ino_t     ino;
+};
+
+// the small files are handed out to the workers one at a time
+struct batch {
+	struct batch_file *files;
+	size_t             n;
+	size_t             cap;
+	size_t             next;
+	uint64_t           split;
+	pthread_mutex_t    lock;
+	int                exit_code;
+	const struct pk   *pk;
+	unsigned           n_pk;
+	const struct sk   *sk;
+};
+
+// files of at least this many blocks are worth all workers
+#define SPLIT_BLOCKS (16)
+#define NENC_SUFFIX  ".nenc"
+
+// records are a big endian length and that many bytes, in both directions. every one
+// is held in memory whole.
+#define RECORD_LENGTH (4)
+#define RECORD_MAX    (64 * 1024 * 1024)
+
+// a block of a record is sealed and opened in scratch of twice this for its block size
+#define RECORD_BOX(bs) (crypto_secretbox_ZEROBYTES + (bs))
+
+// a manifest has the length of the snapshot, the length of its name and the name, then
+// id and length of every chunk
+#define MANIFEST_HEAD  (12)
+#define MANIFEST_ENTRY (CHUNK_ID_LENGTH + 4)
+#define STORE_BUFFER   (4 * CDC_MAX)
+
+// the keys of a chunk store all come from what crypto_box() shares between the two keys.
+// the same data under the same keys ends up in the same chunks.
+struct store {
+	uint8_t    id[KEY_LENGTH];
+	uint8_t    chunk[KEY_LENGTH];
+	uint8_t    manifest[KEY_LENGTH];
+	struct cdc cdc;
+};
+
+static int encrypt_stream(struct input *in, struct output *out, const struct pk *pk, unsigned n_pk, const struct sk *sk, unsigned jobs);
+static int store_snapshot(struct input *in, const struct pk *pk, const struct sk *sk);
+static int restore_snapshot(struct output *out, const struct pk *pk, const struct sk *sk);
+static int init_store(struct store *s, const struct pk *pk, const struct sk *sk);
+static void chunk_id(uint8_t *id, const struct store *s, const uint8_t *m, size_t len);
+static int keep_chunk(const struct store *s, const uint8_t *id, const uint8_t *m, size_t len, uint8_t *c);
+static int open_manifest(const struct store *s, uint8_t **m, size_t *len, size_t *first);
+static int report_store(enum rc rc);
+static int run_batch(const struct pk *pk, unsigned n_pk, const struct sk *sk);
+static void *batch_worker(void *arg);
+static int batch_file(struct batch *b, struct batch_file *f, unsigned jobs);
+static int add_batch(struct batch *b, const char *arg);
+static int walk_batch(struct batch *b, const char *dir, size_t rel);
+static int push_batch(struct batch *b, const char *path, size_t rel, const struct stat *st, bool named);
+static int check_batch(struct batch *b);
+static int by_output(const void *a, const void *b);
+static int make_dirs(const char *path);
+static char *join_path(const char *a, const char *b, const char *c);
+static int seal_records(const struct pk *pk, unsigned n_pk, const struct sk *sk);
+static int open_records(const struct pk *pk, const struct sk *sk);
+static int seal_record(uint8_t *c, const uint8_t *m, size_t len, const struct bk *bk, unsigned n_pk, size_t bs, uint8_t *box);
+static int open_record(uint8_t *m, size_t *len, const uint8_t *c, size_t c_len, const struct bk *bk, uint64_t n, uint8_t **box, size_t *box_cap);
+static size_t sealed_length(size_t len, unsigned n_pk, size_t bs);
+static int read_record(struct input *in, uint8_t **buf, size_t *cap, size_t *len, size_t max, bool *done);
+static int write_record(struct output *out, const uint8_t *buf, size_t len);
+static int grow_buf(uint8_t **buf, size_t *cap, size_t len);
+static int print_row(void *arg, int n, char **values, char **names);
+static int resume_stream(const struct pk *pk, const struct sk *sk);
+static int encrypt_archive(struct input *list, struct output *out, const struct pk *pk, unsigned n_pk, const struct sk *sk);
+static size_t pull_archive(struct input *in, void *buf, size_t len);
+static int next_member(struct archive *a, struct input *in);
+static int next_path(struct archive *a);
+static int add_member(struct archive *a);
+static int grow_index(struct archive *a, size_t len);
+static int read_index(struct input *in, const uint8_t *k, size_t bs, uint8_t **index, size_t *len, uint64_t *end);
+static const uint8_t *next_entry(const uint8_t *p, const uint8_t *end, uint64_t data, struct member *m);
+static int find_member(struct input *in, const uint8_t *k, size_t bs, const char *name, struct member *m);
+static int read_plain(struct input *in, const uint8_t *k, size_t bs, uint64_t off, uint8_t *buf, size_t len);
+static int restore_member(struct output *out, const struct member *m);
+static int update_blocks(struct input *in, struct input *msg, struct output *out, const uint8_t *k, size_t bs, uint64_t n, size_t last, uint64_t off);
+static int save_checkpoint(void *arg, uint64_t blocks, uint64_t length);
+static int stat_input(struct input *in, uint64_t *size, uint64_t *mtime);
+static int append_stream(struct input *in, const struct pk *pk, const struct sk *sk);
+static int append_compact(struct input *in, struct input *msg, const struct pre *pre, const struct pk *pk, const struct sk *sk);
+static int report_seal(enum sc sc, const struct input *in, const struct output *out);
+static int decrypt_stream(struct input *in, struct output *out, const struct pk *pk, const struct sk *sk, unsigned jobs);
+static int report_open(enum sc sc, const struct input *in, const struct output *out, uint64_t i);
+static int get_seal_keys(const char *const *targets, unsigned n, const char *source, struct pk *pk, struct sk *sk);
+static int get_open_keys(struct pk *pk, struct sk *sk);
+static unsigned log_size(size_t bs);
+static int make_head(uint8_t *head, const uint8_t *k, unsigned flags, size_t bs, const struct pk *pk, unsigned n_pk, const struct sk *sk);
+static int read_key(struct input *in, struct pre *pre, uint8_t *k, size_t *bs, unsigned *flags, const struct pk *pk, const struct sk *sk);
+static int read_compact(struct input *in, const struct pre *pre, const struct pk *pk, const struct sk *sk, uint8_t *m, size_t *len);
+static int seal_compact(struct output *out, const uint8_t *m, size_t len, const struct pk *pk, const struct sk *sk);
+static int decrypt_compact(struct input *in, struct output *out, const struct pre *pre, const struct pk *pk, const struct sk *sk);
+static int copy_body(struct input *in, struct output *out, size_t bs);
+static int open_files(struct input *in, struct output *out);
+static int close_files(struct input *in, struct output *out, int exit_code);
+static void     put_u32(uint8_t *p, uint32_t v);
+static uint32_t get_u32(const uint8_t *p);
+static void     put_u64(uint8_t *p, uint64_t v);
+static uint64_t get_u64(const uint8_t *p);
 
 int encrypt() {
+	struct pk  pk[opts.n_targets];
+	struct sk  sk;
+	int        exit_code;
+
+	if ( (exit_code = get_seal_keys(opts.targets, opts.n_targets, opts.source, pk, &sk)) )
+		return exit_code;
+
+	if ( opts.n_files )
+		return run_batch(pk, opts.n_targets, &sk);
+
+	if ( opts.records )
+		return seal_records(pk, opts.n_targets, &sk);
+
+	struct input  in;
+	struct output out;
+
+	if ( opts.snapshot ) {
+		if ( open_input(&in, opts.input, true) ) {
+			fprintf(stderr, "Failed to open \"%s\" for reading.\n", opts.input);
+			return 66;
+		}
+
+		exit_code = store_snapshot(&in, pk, &sk);
+		close_input(&in);
+		return exit_code;
+	}
+
+	if ( opts.append ) {
+		if ( open_input(&in, opts.input, !opts.depth) ) {
+			fprintf(stderr, "Failed to open \"%s\" for reading.\n", opts.input);
+			return 66;
+		}
+
+		exit_code = append_stream(&in, pk, &sk);
+		close_input(&in);
+		return exit_code;
+	}
+
+	if ( opts.resume )
+		return resume_stream(pk, &sk);
+
+	if ( (exit_code = open_files(&in, &out)) )
+		return exit_code;
+
+	if ( opts.archive )
+		exit_code = encrypt_archive(&in, &out, pk, opts.n_targets, &sk);
+	else
+		exit_code = encrypt_stream(&in, &out, pk, opts.n_targets, &sk, opts.jobs);
+	return close_files(&in, &out, exit_code);
+}
+
+int decrypt() {
 	struct pk  pk;
 	struct sk  sk;
-	struct hdr hdr;
+	int        exit_code;
+
+	if ( (exit_code = get_open_keys(&pk, &sk)) )
+		return exit_code;
+
+	if ( opts.n_files )
+		return run_batch(&pk, 1, &sk);
+
+	if ( opts.records )
+		return open_records(&pk, &sk);
+
+	struct input  in;
+	struct output out;
+
+	if ( opts.snapshot ) {
+		if ( open_output(&out, opts.output, false) ) {
+			fprintf(stderr, "Failed to open \"%s\" for writing.\n", opts.output);
+			return 73;
+		}
+
+		exit_code = restore_snapshot(&out, &pk, &sk);
+		if ( close_output(&out) && exit_code == 0 ) {
+			fprintf(stderr, "Failed to close %s.\n", out.name);
+			return 74;
+		}
+		return exit_code;
+	}
+
+	if ( (exit_code = open_files(&in, &out)) )
+		return exit_code;
+
+	exit_code = decrypt_stream(&in, &out, &pk, &sk, opts.jobs);
+	return close_files(&in, &out, exit_code);
+}
+
+// check every block without writing the plaintext anywhere
+int verify() {
+	struct pk     pk;
+	struct sk     sk;
+	struct input  in;
+	int           exit_code;
+
+	if ( (exit_code = get_open_keys(&pk, &sk)) )
+		return exit_code;
+
+	if ( open_input(&in, opts.input, !opts.depth) ) {
+		fprintf(stderr, "Failed to open \"%s\" for reading.\n", opts.input);
+		return 66;
+	}
+
+	exit_code = decrypt_stream(&in, NULL, &pk, &sk, opts.jobs);
+	close_input(&in);
+	return exit_code;
+}
+
+// replace the recipient table of a message. the body is sealed under the data key alone
+// and is copied as it is. without -O a file gets the new header in place if it fits.
+int rewrap() {
+	struct pk     pk;
+	struct sk     sk;
+	struct pk     new_pk[opts.n_new_targets];
+	struct sk     new_sk;
+	struct input  in;
+	struct output out;
+	struct pre    pre;
+	uint8_t       k[KEY_LENGTH];
+	uint8_t       head[PRE_LENGTH + opts.n_new_targets * WRAP_LENGTH];
+	uint8_t       msg[PRE_LENGTH + COMPACT_LENGTH(COMPACT_MAX)];
+	uint8_t      *h     = head;
+	size_t        h_len = sizeof(head);
+	size_t        bs;
+	unsigned      flags;
+	int           exit_code;
+
+	if ( (exit_code = get_open_keys(&pk, &sk)) )
+		return exit_code;
+
+	// by default the one who rewraps becomes the sender
+	if ( (exit_code = get_seal_keys(opts.new_targets, opts.n_new_targets, opts.new_source ? opts.new_source : opts.target, new_pk, &new_sk)) )
+		return exit_code;
+
+	if ( open_input(&in, opts.input, false) ) {
+		fprintf(stderr, "Failed to open \"%s\" for reading.\n", opts.input);
+		return 66;
+	}
+
+	if ( (exit_code = read_key(&in, &pre, k, &bs, &flags, &pk, &sk)) ) {
+		close_input(&in);
+		return exit_code;
+	}
+
+	// a compact message has no data key. it is boxed again as a whole and nothing follows.
+	if ( flags & FLAG_COMPACT ) {
+		uint8_t m[COMPACT_MAX];
+		size_t  len;
+
+		if ( opts.n_new_targets != 1 ) {
+			fprintf(stderr, "Failed to rewrap message from \"%s\" to \"%s\". A compact message has exactly one recipient.\n", opts.source, opts.target);
+			close_input(&in);
+			return 64;
+		}
+
+		if ( (exit_code = read_compact(&in, &pre, &pk, &sk, m, &len)) ) {
+			close_input(&in);
+			return exit_code;
+		}
+
+		memcpy(msg, pre.pre, PRE_LENGTH);
+		if ( box_msg(msg + PRE_LENGTH, m, len, &pre, new_pk, &new_sk) ) {
+			fprintf(stderr, "I'm to dumb to use crypto_box().\n");
+			close_input(&in);
+			return 70;
+		}
+		h     = msg;
+		h_len = PRE_LENGTH + COMPACT_LENGTH(len);
+	} else if ( make_head(head, k, flags, bs, new_pk, opts.n_new_targets, &new_sk) ) {
+		fprintf(stderr, "I'm to dumb to use crypto_box().\n");
+		close_input(&in);
+		return 70;
+	}
+
+	if ( opts.input && !opts.output ) {
+		size_t len = in.off;
+
+		close_input(&in);
+		if ( len != h_len ) {
+			fprintf(stderr, "Failed to rewrap %s in place. The new header has a different size, use -O.\n", opts.input);
+			return 73;
+		}
+
+		if ( reopen_output(&out, opts.input) ) {
+			fprintf(stderr, "Failed to open \"%s\" for writing.\n", opts.input);
+			return 73;
+		}
+
+		if ( write_output_at(&out, h, h_len, 0) ) {
+			fprintf(stderr, "Failed to rewrap message from \"%s\" to \"%s\". Write to %s failed.\n", opts.source, opts.target, out.name);
+			close_output(&out);
+			return 74;
+		}
+
+		if ( close_output(&out) ) {
+			fprintf(stderr, "Failed to close %s.\n", out.name);
+			return 74;
+		}
+		return 0;
+	}
+
+	if ( open_output(&out, opts.output, false) ) {
+		fprintf(stderr, "Failed to open \"%s\" for writing.\n", opts.output);
+		close_input(&in);
+		return 73;
+	}
+
+	struct iovec iov = { .iov_base = h, .iov_len = h_len };
+	if ( write_output(&out, &iov, 1) ) {
+		fprintf(stderr, "Failed to rewrap message from \"%s\" to \"%s\". Write to %s failed.\n", opts.source, opts.target, out.name);
+		exit_code = 74;
+	} else {
+		exit_code = copy_body(&in, &out, bs);
+	}
+
+	return close_files(&in, &out, exit_code);
+}
+
+// seal the blocks the data from in touches again, each one under a new salt. the rest of
+// the message is left alone. data behind the end makes the message longer.
+int update() {
+	struct pk     pk;
+	struct sk     sk;
+	struct input  in;
+	struct input  msg;
+	struct output out;
+	struct pre    pre;
+	uint8_t       k[KEY_LENGTH];
+	size_t        bs;
+	unsigned      flags;
+	int           exit_code;
+
+	if ( (exit_code = get_seal_keys(opts.targets, 1, opts.source, &pk, &sk)) )
+		return exit_code;
+
+	if ( open_input(&msg, opts.update, false) ) {
+		fprintf(stderr, "Failed to open \"%s\" for reading.\n", opts.update);
+		return 66;
+	}
+
+	if ( !msg.regular ) {
+		fprintf(stderr, "Failed to update %s. It is not a regular file.\n", msg.name);
+		close_input(&msg);
+		return 66;
+	}
+
+	if ( (exit_code = read_key(&msg, &pre, k, &bs, &flags, &pk, &sk)) ) {
+		close_input(&msg);
+		return exit_code;
+	}
+
+	if ( !(flags & FLAG_UPDATABLE) ) {
+		fprintf(stderr, "Failed to update %s. Only messages encrypted with -U can be updated.\n", msg.name);
+		close_input(&msg);
+		return 76;
+	}
+
+	size_t   bl   = bs + SALT_LENGTH + MAC_LENGTH;
+	uint64_t data = msg.size - msg.off;
+	uint64_t n    = data / bl + 1;
+	size_t   last = data % bl;
+
+	if ( last < SALT_LENGTH + MAC_LENGTH ) {
+		fprintf(stderr, "Failed to update %s. The message is truncated.\n", msg.name);
+		close_input(&msg);
+		return 76;
+	}
+
+	if ( opts.offset > (n - 1) * bs + last - SALT_LENGTH - MAC_LENGTH ) {
+		fprintf(stderr, "Failed to update %s. The offset lies behind the end of the message.\n", msg.name);
+		close_input(&msg);
+		return 64;
+	}
+
+	if ( open_input(&in, opts.input, false) ) {
+		fprintf(stderr, "Failed to open \"%s\" for reading.\n", opts.input);
+		close_input(&msg);
+		return 66;
+	}
+
+	if ( reopen_output(&out, opts.update) ) {
+		fprintf(stderr, "Failed to open \"%s\" for writing.\n", opts.update);
+		close_input(&in);
+		close_input(&msg);
+		return 73;
+	}
+
+	exit_code = update_blocks(&in, &msg, &out, k, bs, n, last, opts.offset);
+	close_input(&msg);
+	return close_files(&in, &out, exit_code);
+}
+
+// drop a snapshot. chunks no other snapshot refers to go along.
+int forget() {
+	struct pk     pk;
+	struct sk     sk;
+	struct store  st;
+	uint8_t      *m = NULL;
+	size_t        len;
+	size_t        first;
+	int           exit_code;
+
+	if ( (exit_code = get_open_keys(&pk, &sk)) || (exit_code = init_store(&st, &pk, &sk)) )
+		return exit_code;
+
+	if ( (exit_code = report_store(begin_store(true))) )
+		return exit_code;
+
+	if ( (exit_code = open_manifest(&st, &m, &len, &first)) == 0 ) {
+		for ( size_t i = first; exit_code == 0 && i < len; i += MANIFEST_ENTRY ) {
+			enum rc rc = unref_chunk(m + i);
+
+			if ( rc == NOT_FOUND ) {
+				fprintf(stderr, "Failed to drop snapshot \"%s\". A chunk of it is missing.\n", opts.snapshot);
+				exit_code = 76;
+			} else {
+				exit_code = report_store(rc);
+			}
+		}
+	}
+
+	if ( exit_code == 0 )
+		exit_code = report_store(del_snapshot(opts.snapshot));
+
+	free(m);
+	if ( exit_code ) {
+		end_store(false);
+		return exit_code;
+	}
+	return report_store(end_store(true));
+}
+
+// run the SQL of the input on a database behind the VFS. only the pages the statements
+// touch are opened, a database of any size is there at once.
+int query() {
+	struct pk     pk;
+	struct sk     sk;
+	struct input  in;
+	sqlite3      *h;
+	uint8_t      *sql = NULL;
+	size_t        len = 0;
+	size_t        cap = 0;
+	char         *err = NULL;
+	int           rc;
+	int           exit_code;
+
+	if ( (exit_code = get_seal_keys(opts.targets, 1, opts.source, &pk, &sk)) )
+		return exit_code;
+
+	if ( register_vfs(VFS_NAME, &pk, &sk, opts.block_size ? opts.block_size : VFS_BS) != SQLITE_OK ) {
+		fprintf(stderr, "Failed to set up the encryption of \"%s\".\n", opts.query);
+		return 70;
+	}
+
+	if ( open_input(&in, opts.input, false) ) {
+		fprintf(stderr, "Failed to open \"%s\" for reading.\n", opts.input);
+		return 66;
+	}
+
+	do {
+		if ( len + 1 >= cap && (exit_code = grow_buf(&sql, &cap, cap ? 2 * cap : 65536)) ) {
+			free(sql);
+			close_input(&in);
+			return exit_code;
+		}
+		len += read_input(&in, sql + len, cap - len - 1);
+	} while ( !in.eof && !in.failed );
+
+	if ( in.failed ) {
+		fprintf(stderr, "Failed to query \"%s\". Read from %s failed.\n", opts.query, in.name);
+		free(sql);
+		close_input(&in);
+		return 74;
+	}
+	sql[len] = '\0';
+	close_input(&in);
+
+	if ( (rc = sqlite3_open_v2(opts.query, &h, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, VFS_NAME)) != SQLITE_OK ) {
+		fprintf(stderr, "Failed to open \"%s\". %s\n", opts.query, h ? sqlite3_errmsg(h) : "Out of memory.");
+		sqlite3_close(h);
+		free(sql);
+		return rc == SQLITE_NOTADB || rc == SQLITE_CORRUPT ? 76 : 66;
+	}
+
+	// a new database gets a page in every block. one that exists keeps its pages.
+	char pragma[sizeof("PRAGMA page_size = ") + 20];
+	snprintf(pragma, sizeof(pragma), "PRAGMA page_size = %zu", opts.block_size ? opts.block_size : (size_t) VFS_BS);
+
+	if ( (rc = sqlite3_exec(h, pragma, NULL, NULL, &err)) != SQLITE_OK || (rc = sqlite3_exec(h, (const char *) sql, print_row, NULL, &err)) != SQLITE_OK ) {
+		fprintf(stderr, "Failed to query \"%s\". %s\n", opts.query, err ? err : sqlite3_errmsg(h));
+		switch ( rc ) {
+			case SQLITE_CORRUPT:
+			case SQLITE_NOTADB:
+				exit_code = 76;
+				break;
+
+			case SQLITE_BUSY:
+			case SQLITE_LOCKED:
+				exit_code = 75;
+				break;
+
+			case SQLITE_IOERR:
+			case SQLITE_FULL:
+				exit_code = 74;
+				break;
+
+			default:
+				exit_code = 65;
+				break;
+		}
+	}
+
+	sqlite3_free(err);
+	free(sql);
+	if ( sqlite3_close(h) != SQLITE_OK && exit_code == 0 ) {
+		fprintf(stderr, "Failed to close \"%s\". %s\n", opts.query, sqlite3_errmsg(h));
+		exit_code = 74;
+	}
+	return exit_code;
+}
+
+// rows come out like the keys of -l, one per line and tab separated
+static int print_row(void *arg, int n, char **values, char **names) {
+	(void) arg;
+	(void) names;
+
+	for ( int i = 0; i < n; i++ )
+		printf("%s%s", i ? "\t" : "", values[i] ? values[i] : "");
+	printf("\n");
+	return 0;
+}
+
+// print what the header and the footer tell about a message without touching its blocks
+int inspect() {
+	struct pk     pk;
+	struct sk     sk;
+	struct input  in;
+	struct pre    pre;
+	uint8_t       k[KEY_LENGTH];
+	uint8_t       f[FOOTER_LENGTH];
+	size_t        bs;
+	unsigned      flags;
+	int           exit_code;
+
+	if ( (exit_code = get_open_keys(&pk, &sk)) )
+		return exit_code;
+
+	if ( open_input(&in, opts.input, false) ) {
+		fprintf(stderr, "Failed to open \"%s\" for reading.\n", opts.input);
+		return 66;
+	}
+
+	if ( !in.regular ) {
+		fprintf(stderr, "Failed to inspect %s. It is not a regular file.\n", in.name);
+		close_input(&in);
+		return 66;
+	}
+
+	if ( (exit_code = read_key(&in, &pre, k, &bs, &flags, &pk, &sk)) ) {
+		close_input(&in);
+		return exit_code;
+	}
+
+	size_t   over    = MAC_LENGTH + (flags & FLAG_UPDATABLE ? SALT_LENGTH : 0);
+	size_t   bl      = bs + over;
+	size_t   tail    = flags & FLAG_FOOTER ? FOOTER_LENGTH : 0;
+	uint64_t data    = in.size > in.off + tail ? in.size - in.off - tail : 0;
+	uint64_t blocks  = data / bl + 1;
+	uint64_t length  = data - blocks * over;
+	bool     ok      = in.size >= in.off + tail && data % bl >= over;
+
+	if ( flags & FLAG_COMPACT ) {
+		uint8_t m[COMPACT_MAX];
+		size_t  len;
+
+		if ( (exit_code = read_compact(&in, &pre, &pk, &sk, m, &len)) ) {
+			close_input(&in);
+			return exit_code;
+		}
+		blocks = 1;
+		length = len;
+		ok     = true;
+	}
+
+	// frame headers are walked to the final block. it has to end the file.
+	if ( flags & FLAG_FRAMED ) {
+		uint8_t  h[FRAME_LENGTH];
+		uint64_t off    = in.off;
+		bool     final  = false;
+		bool     packed = false;
+		uint32_t len    = 0;
+
+		blocks = 0;
+		length = 0;
+		ok     = true;
+		while ( ok && !final && read_input_at(&in, h, FRAME_LENGTH, off) == FRAME_LENGTH ) {
+			len     = (uint32_t) h[0] << 24 | (uint32_t) h[1] << 16 | (uint32_t) h[2] << 8 | h[3];
+			final   = len & FRAME_FINAL;
+			packed  = len & FRAME_PACKED;
+			len    &= ~(FRAME_FINAL | FRAME_PACKED);
+			ok      = len >= MAC_LENGTH && len <= bl;
+			off    += FRAME_LENGTH + len;
+			length += len - MAC_LENGTH;
+			blocks++;
+		}
+		ok = ok && final && off == in.size && !in.failed;
+
+		// all packed blocks but the final one are full. the final one has to be unpacked.
+		if ( ok && flags & FLAG_PACKED ) {
+			uint64_t i = (blocks - 1) | BLOCK_FINAL | (packed ? BLOCK_PACKED : 0);
+			uint8_t *c = malloc(len + 2 * bs);
+			uint8_t *m = c + len;
+			size_t   n = len - MAC_LENGTH;
+
+			if ( !c ) {
+				fprintf(stderr, "Failed to allocate a buffer of %zu bytes.\n", len + 2 * bs);
+				close_input(&in);
+				return 71;
+			}
+			ok = read_input_at(&in, c, len, off - len) == len && !open_block(m, c, len, i, k) && (!packed || !lz_unpack(m + bs, bs, m, len - MAC_LENGTH, &n));
+			length = (blocks - 1) * bs + n;
+			free(c);
+		}
+	}
+
+	// the footer has to agree with the size of the file around it
+	if ( ok && tail ) {
+		uint64_t l, n;
+		size_t   f_bs;
+
+		if ( read_input_at(&in, f, FOOTER_LENGTH, in.size - FOOTER_LENGTH) != FOOTER_LENGTH || in.failed ) {
+			fprintf(stderr, "Failed to inspect message from \"%s\" to \"%s\". Read from %s failed.\n", opts.source, opts.target, in.name);
+			close_input(&in);
+			return 74;
+		}
+		ok = !open_footer(f, k, &l, &n, &f_bs) && l == length && n == blocks && f_bs == bs;
+	}
+
+	// the members of an archive are listed behind the rest. the index is checked first.
+	struct member m;
+	uint8_t      *index = NULL;
+	size_t        index_len;
+	uint64_t      data_end;
+
+	if ( ok && flags & FLAG_ARCHIVE ) {
+		if ( (exit_code = read_index(&in, k, bs, &index, &index_len, &data_end)) ) {
+			close_input(&in);
+			return exit_code;
+		}
+		for ( const uint8_t *p = index; p && p < index + index_len; )
+			ok = (p = next_entry(p, index + index_len, data_end, &m)) != NULL;
+	}
+	close_input(&in);
+
+	if ( !ok ) {
+		fprintf(stderr, "Failed to inspect message from \"%s\" to \"%s\". The message is truncated or its footer is corrupted.\n", opts.source, opts.target);
+		free(index);
+		return 76;
+	}
+
+	printf("version\t%u\n", is_pre(&pre) && PRE_VERSION(&pre) == VERSION ? VERSION : 0);
+	printf("block_size\t%zu\n", bs);
+	printf("recipients\t%u\n", is_pre(&pre) && PRE_VERSION(&pre) == VERSION ? PRE_RECIPIENTS(&pre) : 1);
+	printf("blocks\t%" PRIu64 "\n", blocks);
+	printf("length\t%" PRIu64 "\n", length);
+	printf("footer\t%s\n", tail ? "verified" : "none");
+	printf("framed\t%s\n", flags & FLAG_FRAMED ? "yes" : "no");
+	printf("compact\t%s\n", flags & FLAG_COMPACT ? "yes" : "no");
+	printf("packed\t%s\n", flags & FLAG_PACKED ? "yes" : "no");
+	printf("updatable\t%s\n", flags & FLAG_UPDATABLE ? "yes" : "no");
+	printf("archive\t%s\n", flags & FLAG_ARCHIVE ? "yes" : "no");
+
+	// mode, length, modification time and path of every member
+	for ( const uint8_t *p = index; p && p < index + index_len; ) {
+		p = next_entry(p, index + index_len, data_end, &m);
+		printf("member\t%04o\t%" PRIu64 "\t%" PRIu64 "\t%.*s\n", (unsigned) m.mode & 07777, m.len, m.mtime / 1000000000, (int) m.path_len, m.path);
+	}
+	free(index);
+
+	return 0;
+}
+
+static int get_seal_keys(const char *const *targets, unsigned n, const char *source, struct pk *pk, struct sk *sk) {
 	enum   rc  rc;
     
-	switch ( (rc = get_pk(opts.target, &pk)) ) {
-		case PK_FOUND:
-			break;
+	for ( unsigned t = 0; t < n; t++ ) {
+		switch ( (rc = get_pk(targets[t], &pk[t])) ) {
+			case PK_FOUND:
+				break;
 
-		case DB_LOCKED:
-			fprintf(stderr, "Failed to retrieve public key. The database is locked.\n");
-			return 75;
-			break;
+			case DB_LOCKED:
+				fprintf(stderr, "Failed to retrieve public key. The database is locked.\n");
+				return 75;
+				break;
 
-		case DB_BUSY:
-			fprintf(stderr, "Failed to retrieve public key. The database is busy.\n");
-			return 75;
-			break;
+			case DB_BUSY:
+				fprintf(stderr, "Failed to retrieve public key. The database is busy.\n");
+				return 75;
+				break;
         
-		case NOT_FOUND:
-			fprintf(stderr, "Their is no public key named \"%s\" in the database.\n", opts.target);
-			return 1;
-			break;
+			case NOT_FOUND:
+				fprintf(stderr, "Their is no public key named \"%s\" in the database.\n", targets[t]);
+				return 1;
+				break;
 
-		default:
-			fprintf(stderr, "Failed to retrieve public key (rc = %i).\n", rc);
-			return 70;
-			break;
+			default:
+				fprintf(stderr, "Failed to retrieve public key (rc = %i).\n", rc);
+				return 70;
+				break;
+		}
 	}
 
-	switch ( (rc = get_sk(opts.source, &sk)) ) {
+	switch ( (rc = get_sk(source, sk)) ) {
 		case SK_FOUND:
 			break;
 
@@ -55,7 +815,7 @@ int encrypt() {
 			break;
 
 		case NOT_FOUND:
-			fprintf(stderr, "Their is no private key named \"%s\" in the database.\n", opts.source);
+			fprintf(stderr, "Their is no private key named \"%s\" in the database.\n", source);
 			return 1;
 			break;
 
@@ -64,64 +824,14 @@ int encrypt() {
 			return 70;
 			break;
 	}
-	
-	init_hdr(&hdr);
-	uint8_t k[crypto_secretbox_KEYBYTES];
-	memcpy(k, &hdr.hdr[NONCE_LENGTH + MAC_LENGTH], sizeof(k));
-	
-	if ( enc_hdr(&hdr, &pk, &sk) ) {
-		fprintf(stderr, "I'm to dumb to use crypto_box().\n");
-		return 70;
-	}
-
-	if ( fwrite(&hdr.hdr, sizeof(hdr.hdr), 1, stdout) != 1 || ferror(stdout) ) {
-		fprintf(stderr, "Failed to encrypt message from \"%s\" to \"%s\". Write to standard output failed.\n", opts.source, opts.target);
-		return 74;
-	}
-	
-	uint8_t n[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
-	uint8_t m[crypto_secretbox_ZEROBYTES + BS];
-	uint8_t c[crypto_secretbox_ZEROBYTES + BS];
-	
-	for ( uint64_t i = 0; true; i++ ) {
-		if ( i == UINT64_MAX ) {
-			fprintf(stderr, "You managed to encrypt 2^64 blocks -> Overflow :-(.");
-			return 70;
-		}
-		
-		n[0] = i >> 56; n[1] = i >> 48; n[2] = i >> 40; n[3] = i >> 32;
-		n[4] = i >> 24; n[5] = i >> 16; n[6] = i >>  8; n[7] = i >>  0;
-
-		memset(m, 0, crypto_secretbox_ZEROBYTES);
-		size_t j = fread(m + crypto_secretbox_ZEROBYTES, 1, BS, stdin);
-		if ( ferror(stdin) ) {
-			fprintf(stderr, "Failed to encrypt message from \"%s\" to \"%s\". Read from standard input failed.\n", opts.source, opts.target);
-			return 74;
-		}
-		
-		if ( crypto_secretbox(c, m, crypto_secretbox_ZEROBYTES + j, n, k) ) {
-			fprintf(stderr, "I'm to dumb to use crypto_secretbox().\n");
-			return 70;
-		}
 
-		if ( fwrite(c + crypto_secretbox_BOXZEROBYTES, j + crypto_secretbox_BOXZEROBYTES, 1, stdout) != 1 || ferror(stdout) ) {
-			fprintf(stderr, "Failed to encrypt message from \"%s\" to \"%s\". Write to standard output failed.\n", opts.source, opts.target);
-			return 74;
-		}
-		
-		if ( feof(stdin) )
-			break;
-	}
 	return 0;
 }
 
-int decrypt() {
-	struct pk  pk;
-	struct sk  sk;
-	struct hdr hdr;
+static int get_open_keys(struct pk *pk, struct sk *sk) {
 	enum   rc  rc;
 	    
-	switch ( (rc = get_pk(opts.source, &pk)) ) {
+	switch ( (rc = get_pk(opts.source, pk)) ) {
 		case PK_FOUND:
 			break;
 
@@ -146,7 +856,7 @@ int decrypt() {
 			break;
 	}
 
-	switch ( (rc = get_sk(opts.target, &sk)) ) {
+	switch ( (rc = get_sk(opts.target, sk)) ) {
     	case SK_FOUND:
 			break;
 
@@ -170,70 +880,2091 @@ int decrypt() {
 			return 70;
 			break;
 	}
-	
-	if ( fread(hdr.hdr, sizeof(hdr.hdr), 1, stdin) != 1 || ferror(stdin) ) {
-    	fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". Read from standard input failed.\n", opts.source, opts.target);
-		return 74;
-	}
 
-	if ( feof(stdin) ) {
-    	fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". The message is too short to be valid.\n", opts.source, opts.target);
-		return 76;
-	}
-	
-	if ( dec_hdr(&hdr, &pk, &sk) ) {
-		fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". The header is corrupted.\n", opts.source, opts.target);
-		return 76;
-	}
+	return 0;
+}
 
-	uint8_t k[crypto_secretbox_KEYBYTES];
-	memcpy(k, &hdr.hdr[NONCE_LENGTH + MAC_LENGTH], sizeof(k));
-	
-	uint8_t n[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
-	uint8_t m[crypto_secretbox_ZEROBYTES + BS];
-	uint8_t c[crypto_secretbox_ZEROBYTES + BS];
-	
-	for ( uint64_t i = 0; true; i++ ) {
-		if ( feof(stdin) )
-			break;
-		
-		if ( i == UINT64_MAX ) {
-			fprintf(stderr, "You managed to decrypt 2^64 blocks -> Overflow :-(.");
-			return 70;
-		}
+// the body is sealed once. every recipient gets the data key wrapped in the header.
+static int encrypt_stream(struct input *in, struct output *out, const struct pk *pk, unsigned n_pk, const struct sk *sk, unsigned jobs) {
+	struct stream st;
+	uint8_t       k[KEY_LENGTH];
+	uint8_t       head[PRE_LENGTH + n_pk * WRAP_LENGTH];
+	uint8_t       m[COMPACT_MAX + 1];
+	size_t        len = 0;
 
-		n[0] = i >> 56; n[1] = i >> 48; n[2] = i >> 40; n[3] = i >> 32;
-		n[4] = i >> 24; n[5] = i >> 16; n[6] = i >>  8; n[7] = i >>  0;
-		
-		memset(c, 0, crypto_secretbox_BOXZEROBYTES);
-		size_t j = fread(c + crypto_secretbox_BOXZEROBYTES, 1, BS + MAC_LENGTH, stdin);
-		if ( ferror(stdin) ) {
-			fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". Read from standard output failed.\n", opts.source, opts.target);
-			return 74;
-		}
-		
-			
-		if ( j < MAC_LENGTH ) {
-			fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". The block #%" PRIu64 " is too short be valid.\n", opts.source, opts.target, i);
-			return 76;
-		}
-    	
-		if ( crypto_secretbox_open(m, c, crypto_secretbox_BOXZEROBYTES + j, n, k) ) {
-			fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". The block #%" PRIu64 " has an invalid MAC.\n", opts.source, opts.target, i);
-			return 76;
-		}
-		
-		j -= MAC_LENGTH;
-		if ( j != 0 && fwrite(m + crypto_secretbox_ZEROBYTES, j, 1, stdout) != 1 ) {
-			fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". Write to standard output failed.\n", opts.source, opts.target);
-			return 74;
-		}
+	st.bs      = opts.block_size ? opts.block_size : BS;
+	st.framed  = opts.latency || opts.flush || opts.pack;
+	st.latency = opts.latency;
+	st.flush   = opts.flush;
+	st.pack    = opts.pack;
+	st.salted  = opts.updatable;
 
-		if ( ferror(stdout) ) {
-			fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". I/O error on standard output.\n", opts.source, opts.target);
-			return 74;
+	// the index of an archive is found from its end. the footer tells if that is the end.
+	st.footer  = opts.footer || opts.archive;
+
+	// small messages are boxed whole. a pipe has to be read to find out, what was read
+	// goes in front of the first block otherwise. a footer, a block size or packing
+	// asked for explicitly has no place in a compact message.
+	if ( n_pk == 1 && !opts.footer && !opts.block_size && !opts.pack && !opts.latency && !opts.flush && !opts.updatable && !opts.archive ) {
+		if ( !in->regular || in->size <= in->off + COMPACT_MAX ) {
+			len = read_input(in, m, in->regular ? COMPACT_MAX : COMPACT_MAX + 1);
+			if ( in->failed ) {
+				fprintf(stderr, "Failed to encrypt message from \"%s\" to \"%s\". Read from %s failed.\n", opts.source, opts.target, in->name);
+				return 74;
+			}
+			if ( len <= COMPACT_MAX )
+				return seal_compact(out, m, len, pk, sk);
 		}
 	}
-	
-	return 0;
+
+	init_key(k);
+	if ( make_head(head, k, (st.footer ? FLAG_FOOTER : 0) | (st.framed ? FLAG_FRAMED : 0) | (st.pack ? FLAG_PACKED : 0) | (st.salted ? FLAG_UPDATABLE : 0) | (opts.archive ? FLAG_ARCHIVE : 0), st.bs, pk, n_pk, sk) ) {
+		fprintf(stderr, "I'm to dumb to use crypto_box().\n");
+		return 70;
+	}
+
+	st.k         = k;
+	st.jobs      = jobs;
+	st.depth     = opts.depth;
+	st.head      = head;
+	st.head_len  = sizeof(head);
+	st.first     = 0;
+	st.from      = 0;
+	st.to        = UINT64_MAX;
+	st.carry     = len ? m : NULL;
+	st.carry_len = len;
+	st.save      = NULL;
+	st.save_arg  = NULL;
+
+	if ( !opts.checkpoint )
+		return report_seal(seal_blocks(in, out, &st), in, out);
+
+	struct checkpoint cp = { .head = head, .head_len = sizeof(head), .pk = pk, .sk = sk };
+	int               exit_code;
+
+	if ( stat_input(in, &cp.size, &cp.mtime) )
+		return 74;
+	st.save     = save_checkpoint;
+	st.save_arg = &cp;
+
+	// a finished job has nothing left to resume
+	if ( (exit_code = report_seal(seal_blocks(in, out, &st), in, out)) == 0 && unlink(opts.checkpoint) && errno != ENOENT )
+		fprintf(stderr, "Failed to remove checkpoint \"%s\".\n", opts.checkpoint);
+	return exit_code;
+}
+
+// pick up a job where its checkpoint left off. the output up to there is kept. the header
+// in the checkpoint has to be the one in front of it and the input must not have changed.
+static int resume_stream(const struct pk *pk, const struct sk *sk) {
+	struct input      cp_in;
+	struct input      in;
+	struct output     out;
+	struct pre        pre;
+	struct stream     st;
+	struct checkpoint cp;
+	uint8_t           k[KEY_LENGTH];
+	uint8_t           head[PRE_LENGTH + MAX_RECIPIENTS * WRAP_LENGTH];
+	uint8_t           old[sizeof(head)];
+	uint8_t           c[COMPACT_LENGTH(CHECKPOINT_LENGTH) + 1];
+	uint8_t           rec[CHECKPOINT_LENGTH];
+	unsigned          flags;
+	uint64_t          size;
+	uint64_t          mtime;
+	int               exit_code;
+
+	if ( open_input(&cp_in, opts.checkpoint, false) ) {
+		fprintf(stderr, "Failed to open checkpoint \"%s\" for reading.\n", opts.checkpoint);
+		return 66;
+	}
+
+	if ( (exit_code = read_key(&cp_in, &pre, k, &st.bs, &flags, pk, sk)) ) {
+		close_input(&cp_in);
+		return exit_code;
+	}
+
+	size_t n = read_input(&cp_in, c, sizeof(c));
+	cp.head_len = cp_in.off - n;
+	if ( !cp_in.failed && cp_in.regular && read_input_at(&cp_in, head, cp.head_len, 0) != cp.head_len )
+		cp_in.failed = true;
+	close_input(&cp_in);
+
+	if ( cp_in.failed ) {
+		fprintf(stderr, "Failed to resume from \"%s\". Read from %s failed.\n", opts.checkpoint, cp_in.name);
+		return 74;
+	}
+
+	if ( !is_pre(&pre) || PRE_VERSION(&pre) != VERSION || flags & FLAG_COMPACT || !cp_in.regular || n != COMPACT_LENGTH(CHECKPOINT_LENGTH) || unbox_msg(rec, c, n, &pre, pk, sk) ) {
+		fprintf(stderr, "Failed to resume from \"%s\". The checkpoint is corrupted or not for these keys.\n", opts.checkpoint);
+		return 76;
+	}
+
+	uint64_t blocks = get_u64(rec +  0);
+	uint64_t length = get_u64(rec +  8);
+	cp.size         = get_u64(rec + 16);
+	cp.mtime        = get_u64(rec + 24);
+
+	if ( open_input(&in, opts.input, !opts.depth) ) {
+		fprintf(stderr, "Failed to open \"%s\" for reading.\n", opts.input);
+		return 66;
+	}
+
+	// the blocks on disk must have come from exactly this input
+	if ( stat_input(&in, &size, &mtime) ) {
+		close_input(&in);
+		return 74;
+	}
+	if ( size != cp.size || mtime != cp.mtime ) {
+		fprintf(stderr, "Failed to resume from \"%s\". %s changed since the checkpoint was written.\n", opts.checkpoint, in.name);
+		close_input(&in);
+		return 66;
+	}
+
+	struct input prev;
+	if ( open_input(&prev, opts.output, false) ) {
+		fprintf(stderr, "Failed to open \"%s\" for reading.\n", opts.output);
+		close_input(&in);
+		return 66;
+	}
+	bool same = prev.regular && prev.size >= length && read_input(&prev, old, cp.head_len) == cp.head_len && !memcmp(old, head, cp.head_len);
+	close_input(&prev);
+
+	if ( !same ) {
+		fprintf(stderr, "Failed to resume from \"%s\". %s is not the output it was written for.\n", opts.checkpoint, opts.output);
+		close_input(&in);
+		return 76;
+	}
+
+	if ( skip_input(&in, blocks * st.bs) ) {
+		fprintf(stderr, "Failed to encrypt message from \"%s\" to \"%s\". Read from %s failed.\n", opts.source, opts.target, in.name);
+		close_input(&in);
+		return 74;
+	}
+
+	if ( reopen_output(&out, opts.output) || seek_output(&out, length) ) {
+		fprintf(stderr, "Failed to open \"%s\" for writing.\n", opts.output);
+		if ( out.fd != -1 )
+			close_output(&out);
+		close_input(&in);
+		return 73;
+	}
+
+	cp.head      = head;
+	cp.pk        = pk;
+	cp.sk        = sk;
+	st.k         = k;
+	st.jobs      = opts.jobs;
+	st.depth     = opts.depth;
+	st.head      = NULL;
+	st.head_len  = 0;
+	st.first     = blocks;
+	st.from      = 0;
+	st.to        = UINT64_MAX;
+	st.footer    = flags & FLAG_FOOTER;
+	st.carry     = NULL;
+	st.carry_len = 0;
+	st.framed    = flags & FLAG_FRAMED;
+	st.latency   = 0;
+	st.flush     = 0;
+	st.pack      = flags & FLAG_PACKED;
+	st.salted    = flags & FLAG_UPDATABLE;
+	st.save      = save_checkpoint;
+	st.save_arg  = &cp;
+
+	// whatever the killed run wrote behind the checkpoint is cut off
+	exit_code = report_seal(seal_blocks(&in, &out, &st), &in, &out);
+	if ( exit_code == 0 && truncate_output(&out) ) {
+		fprintf(stderr, "Failed to encrypt message from \"%s\" to \"%s\". Write to %s failed.\n", opts.source, opts.target, out.name);
+		exit_code = 74;
+	}
+	if ( exit_code == 0 && unlink(opts.checkpoint) && errno != ENOENT )
+		fprintf(stderr, "Failed to remove checkpoint \"%s\".\n", opts.checkpoint);
+
+	return close_files(&in, &out, exit_code);
+}
+
+// blocks are read, opened, patched and sealed one at a time. the final block has to stay
+// short. one that filled up gets an empty block behind it.
+static int update_blocks(struct input *in, struct input *msg, struct output *out, const uint8_t *k, size_t bs, uint64_t n, size_t last, uint64_t off) {
+	size_t    bl   = bs + SALT_LENGTH + MAC_LENGTH;
+	uint64_t  head = msg->off;
+	uint64_t  w    = UINT64_MAX;
+	size_t    len  = 0;
+	uint8_t  *c    = malloc(bl);
+	uint8_t  *m    = malloc(bs);
+	int       exit_code = 0;
+
+	if ( !c || !m ) {
+		fprintf(stderr, "Failed to allocate a buffer of %zu bytes.\n", bl);
+		free(m);
+		free(c);
+		return 71;
+	}
+
+	for ( uint64_t i = off / bs, at = off % bs; true; i++, at = 0 ) {
+		size_t have = 0;
+
+		if ( i < n ) {
+			size_t stored = i == n - 1 ? last : bl;
+
+			if ( read_input_at(msg, c, stored, head + i * bl) != stored || msg->failed ) {
+				fprintf(stderr, "Failed to update %s. Read failed.\n", msg->name);
+				exit_code = 74;
+				break;
+			}
+			if ( open_salted(m, c, stored, i, k) ) {
+				fprintf(stderr, "Failed to update %s. The block #%" PRIu64 " has an invalid MAC.\n", msg->name, i);
+				exit_code = 76;
+				break;
+			}
+			have = stored - SALT_LENGTH - MAC_LENGTH;
+		}
+
+		size_t got = read_input(in, m + at, bs - at);
+		if ( in->failed ) {
+			fprintf(stderr, "Failed to update %s. Read from %s failed.\n", msg->name, in->name);
+			exit_code = 74;
+			break;
+		}
+		if ( !got )
+			break;
+
+		len = at + got > have ? at + got : have;
+		if ( seal_salted(c, m, len, i, k) ) {
+			fprintf(stderr, "I'm to dumb to use crypto_secretbox().\n");
+			exit_code = 70;
+			break;
+		}
+		if ( write_output_at(out, c, SALT_LENGTH + MAC_LENGTH + len, head + i * bl) ) {
+			fprintf(stderr, "Failed to update %s. Write failed.\n", msg->name);
+			exit_code = 74;
+			break;
+		}
+		w = i;
+
+		if ( got < bs - at )
+			break;
+	}
+
+	if ( exit_code == 0 && w != UINT64_MAX && w + 1 >= n && len == bs ) {
+		if ( seal_salted(c, m, 0, w + 1, k) ) {
+			fprintf(stderr, "I'm to dumb to use crypto_secretbox().\n");
+			exit_code = 70;
+		} else if ( write_output_at(out, c, SALT_LENGTH + MAC_LENGTH, head + (w + 1) * bl) ) {
+			fprintf(stderr, "Failed to update %s. Write failed.\n", msg->name);
+			exit_code = 74;
+		}
+	}
+
+	free(m);
+	free(c);
+	return exit_code;
+}
+
+// the checkpoint is the header followed by the boxed record. it replaces the last one as a whole.
+static int save_checkpoint(void *arg, uint64_t blocks, uint64_t length) {
+	const struct checkpoint *cp = arg;
+	struct pre               pre;
+	uint8_t                  rec[CHECKPOINT_LENGTH];
+	uint8_t                  buf[cp->head_len + COMPACT_LENGTH(CHECKPOINT_LENGTH)];
+
+	put_u64(rec +  0, blocks);
+	put_u64(rec +  8, length);
+	put_u64(rec + 16, cp->size);
+	put_u64(rec + 24, cp->mtime);
+
+	memcpy(pre.pre, cp->head, PRE_LENGTH);
+	memcpy(buf, cp->head, cp->head_len);
+	if ( box_msg(buf + cp->head_len, rec, sizeof(rec), &pre, cp->pk, cp->sk) )
+		return -1;
+
+	return replace_file(opts.checkpoint, buf, sizeof(buf));
+}
+
+static int stat_input(struct input *in, uint64_t *size, uint64_t *mtime) {
+	struct stat st;
+
+	if ( fstat(in->fd, &st) ) {
+		fprintf(stderr, "Failed to stat %s.\n", in->name);
+		return -1;
+	}
+
+	*size  = st.st_size;
+	*mtime = (uint64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	return 0;
+}
+
+// the members are read through the block engine like one long input
+static int encrypt_archive(struct input *list, struct output *out, const struct pk *pk, unsigned n_pk, const struct sk *sk) {
+	struct archive *a = calloc(1, sizeof(*a));
+	struct input    src;
+	int             exit_code;
+
+	if ( !a ) {
+		fprintf(stderr, "Failed to allocate a buffer of %zu bytes.\n", sizeof(*a));
+		return 71;
+	}
+
+	memset(&src, 0, sizeof(src));
+	a->list  = list;
+	src.name = list->name;
+	src.fd   = -1;
+	src.pull = pull_archive;
+	src.arg  = a;
+
+	// a member that can't be read is reported as such
+	if ( (exit_code = encrypt_stream(&src, out, pk, n_pk, sk, opts.jobs)) && a->exit_code )
+		exit_code = a->exit_code;
+
+	if ( a->reading )
+		close_input(&a->file);
+	free(a->index);
+	free(a);
+	return exit_code;
+}
+
+// hand out the members one after the other and the index behind them
+static size_t pull_archive(struct input *in, void *buf, size_t len) {
+	struct archive *a = in->arg;
+	uint8_t        *p = buf;
+	size_t          j = 0;
+
+	while ( j < len && !in->eof && !in->failed ) {
+		if ( a->reading ) {
+			j += read_input(&a->file, p + j, len - j);
+			if ( a->file.failed ) {
+				in->name   = a->file.name;
+				in->failed = true;
+			} else if ( input_eof(&a->file) && add_member(a) ) {
+				in->failed = true;
+			}
+		} else if ( !a->done ) {
+			if ( next_member(a, in) )
+				in->failed = true;
+		} else {
+			size_t n = a->index_len - a->sent < len - j ? a->index_len - a->sent : len - j;
+
+			memcpy(p + j, a->index + a->sent, n);
+			a->sent += n;
+			j       += n;
+			in->eof  = a->sent == a->index_len;
+		}
+	}
+
+	return j;
+}
+
+// open the file on the next line of the list. the end of the list closes the index.
+static int next_member(struct archive *a, struct input *in) {
+	struct stat st;
+	int         rc;
+
+	if ( (rc = next_path(a)) < 0 ) {
+		in->name = a->list->name;
+		return -1;
+	}
+
+	if ( rc > 0 ) {
+		if ( grow_index(a, INDEX_TAIL) )
+			return -1;
+		put_u64(a->index + a->index_len, a->index_len);
+		a->index_len += INDEX_TAIL;
+		a->done       = true;
+		return 0;
+	}
+
+	in->name = a->path;
+	if ( open_input(&a->file, a->path, true) ) {
+		fprintf(stderr, "Failed to open \"%s\" for reading.\n", a->path);
+		a->exit_code = 66;
+		return -1;
+	}
+
+	if ( !a->file.regular || fstat(a->file.fd, &st) ) {
+		fprintf(stderr, "Failed to archive \"%s\". It is not a regular file.\n", a->path);
+		a->exit_code = 66;
+		close_input(&a->file);
+		return -1;
+	}
+
+	a->mode    = st.st_mode;
+	a->mtime   = (uint64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	a->reading = true;
+	return 0;
+}
+
+// the next line of the list. empty lines are skipped. returns 1 at the end of the list.
+static int next_path(struct archive *a) {
+	a->path_len = 0;
+
+	for ( ;; ) {
+		if ( a->pos == a->end ) {
+			a->pos = 0;
+			a->end = read_input(a->list, a->buf, sizeof(a->buf));
+			if ( a->list->failed )
+				return -1;
+			if ( a->end == 0 )
+				break;
+		}
+
+		char ch = a->buf[a->pos++];
+		if ( ch == '\n' ) {
+			if ( a->path_len )
+				break;
+			continue;
+		}
+
+		if ( a->path_len == sizeof(a->path) - 1 ) {
+			fprintf(stderr, "Failed to archive \"%.*s...\". The path is too long.\n", 64, a->path);
+			a->exit_code = 65;
+			return -1;
+		}
+		a->path[a->path_len++] = ch;
+	}
+
+	a->path[a->path_len] = '\0';
+	return a->path_len ? 0 : 1;
+}
+
+// the whole file went into the archive. it gets its entry.
+static int add_member(struct archive *a) {
+	uint8_t *e;
+	uint64_t len = a->file.off;
+
+	close_input(&a->file);
+	a->reading = false;
+
+	if ( grow_index(a, ENTRY_LENGTH + a->path_len) )
+		return -1;
+
+	e = a->index + a->index_len;
+	put_u64(e +  0, a->off);
+	put_u64(e +  8, len);
+	put_u64(e + 16, a->mtime);
+	e[24] = a->mode >> 24;
+	e[25] = a->mode >> 16;
+	e[26] = a->mode >> 8;
+	e[27] = a->mode;
+	e[28] = a->path_len >> 8;
+	e[29] = a->path_len;
+	memcpy(e + ENTRY_LENGTH, a->path, a->path_len);
+
+	a->index_len += ENTRY_LENGTH + a->path_len;
+	a->off       += len;
+	return 0;
+}
+
+static int grow_index(struct archive *a, size_t len) {
+	size_t   cap = a->index_cap ? a->index_cap : 4096;
+	uint8_t *index;
+
+	if ( a->index_len + len <= a->index_cap )
+		return 0;
+
+	while ( cap < a->index_len + len )
+		cap *= 2;
+
+	if ( !(index = realloc(a->index, cap)) ) {
+		fprintf(stderr, "Failed to allocate a buffer of %zu bytes.\n", cap);
+		a->exit_code = 71;
+		return -1;
+	}
+
+	a->index     = index;
+	a->index_cap = cap;
+	return 0;
+}
+
+// every file of a batch is sealed or opened on its own. the keys are looked up once.
+// large files get all workers one after the other, the workers share the rest.
+static int run_batch(const struct pk *pk, unsigned n_pk, const struct sk *sk) {
+	struct batch b;
+	struct stat  st;
+	uint8_t      byte;
+	pthread_t    workers[opts.jobs];
+	unsigned     started = 0;
+
+	memset(&b, 0, sizeof(b));
+	b.pk    = pk;
+	b.n_pk  = n_pk;
+	b.sk    = sk;
+	b.split = SPLIT_BLOCKS * (opts.block_size ? opts.block_size : BS);
+
+	if ( opts.output && (stat(opts.output, &st) || !S_ISDIR(st.st_mode)) ) {
+		fprintf(stderr, "Failed to write into \"%s\". It is not a directory.\n", opts.output);
+		return 73;
+	}
+
+	// nothing is written unless all arguments can be taken
+	int exit_code = 0;
+	for ( unsigned f = 0; f < opts.n_files && !exit_code; f++ )
+		exit_code = add_batch(&b, opts.files[f]);
+	if ( !exit_code )
+		exit_code = check_batch(&b);
+	if ( exit_code )
+		b.n = 0;
+
+	for ( size_t f = 0; f < b.n; f++ ) {
+		if ( b.files[f].size >= b.split ) {
+			int exit_code = batch_file(&b, &b.files[f], opts.jobs);
+			if ( !b.exit_code )
+				b.exit_code = exit_code;
+		}
+	}
+
+	// randombytes opens /dev/urandom on its first call and takes no lock for it. make that
+	// call here, before the workers seal files at the same time. the byte itself is unused.
+	randombytes(&byte, 1);
+
+	if ( b.n && pthread_mutex_init(&b.lock, NULL) == 0 ) {
+		for ( ; started + 1 < opts.jobs && started + 1 < b.n; started++ ) {
+			if ( pthread_create(&workers[started], NULL, batch_worker, &b) )
+				break;
+		}
+		batch_worker(&b);
+		for ( unsigned t = 0; t < started; t++ )
+			pthread_join(workers[t], NULL);
+		pthread_mutex_destroy(&b.lock);
+	}
+
+	for ( size_t f = 0; f < b.n; f++ ) {
+		free(b.files[f].in);
+		free(b.files[f].out);
+	}
+	free(b.files);
+	return exit_code ? exit_code : b.exit_code;
+}
+
+static void *batch_worker(void *arg) {
+	struct batch      *b = arg;
+	struct batch_file *f;
+
+	for ( ;; ) {
+		pthread_mutex_lock(&b->lock);
+		while ( b->next < b->n && b->files[b->next].size >= b->split )
+			b->next++;
+		f = b->next < b->n ? &b->files[b->next++] : NULL;
+		pthread_mutex_unlock(&b->lock);
+
+		if ( !f )
+			return NULL;
+
+		int exit_code = batch_file(b, f, 1);
+		pthread_mutex_lock(&b->lock);
+		if ( !b->exit_code )
+			b->exit_code = exit_code;
+		pthread_mutex_unlock(&b->lock);
+	}
+}
+
+// the output is written next to its name and only takes its place once it is complete.
+// whatever was there before is left alone if anything fails.
+static int batch_file(struct batch *b, struct batch_file *f, unsigned jobs) {
+	struct input  in;
+	struct output out;
+	int           exit_code;
+
+	if ( open_input(&in, f->in, !opts.depth) ) {
+		fprintf(stderr, "Failed to open \"%s\" for reading.\n", f->in);
+		return 66;
+	}
+
+	if ( (opts.output && make_dirs(f->out)) || open_replacement(&out, f->out, opts.zero_copy) ) {
+		fprintf(stderr, "Failed to open \"%s.new\" for writing.\n", f->out);
+		close_input(&in);
+		return 73;
+	}
+
+	if ( opts.op == ENCRYPT )
+		exit_code = encrypt_stream(&in, &out, b->pk, b->n_pk, b->sk, jobs);
+	else
+		exit_code = decrypt_stream(&in, &out, b->pk, b->sk, jobs);
+
+	if ( exit_code == 0 && finish_replacement(&out, f->out) ) {
+		fprintf(stderr, "Failed to replace \"%s\".\n", f->out);
+		exit_code = 74;
+	}
+
+	if ( (exit_code = close_files(&in, &out, exit_code)) ) {
+		fprintf(stderr, "Failed to %s \"%s\".\n", opts.op == ENCRYPT ? "encrypt" : "decrypt", f->in);
+		drop_replacement(f->out);
+	}
+
+	return exit_code;
+}
+
+// a directory is walked. the last part of the argument is where names below -O start.
+static int add_batch(struct batch *b, const char *arg) {
+	struct stat st;
+	char       *path = strdup(arg);
+	size_t      len  = path ? strlen(path) : 0;
+	int         exit_code;
+
+	if ( !path ) {
+		fprintf(stderr, "Failed to allocate a buffer of %zu bytes.\n", strlen(arg) + 1);
+		return 71;
+	}
+
+	while ( len > 1 && path[len - 1] == '/' )
+		path[--len] = '\0';
+
+	char   *slash = strrchr(path, '/');
+	size_t  rel   = slash && slash[1] ? slash + 1 - path : 0;
+
+	if ( stat(path, &st) ) {
+		fprintf(stderr, "Failed to open \"%s\" for reading.\n", path);
+		exit_code = 66;
+	} else if ( S_ISDIR(st.st_mode) ) {
+		exit_code = walk_batch(b, path, rel);
+	} else if ( S_ISREG(st.st_mode) ) {
+		exit_code = push_batch(b, path, rel, &st, true);
+	} else {
+		fprintf(stderr, "Failed to open \"%s\". It is not a regular file.\n", path);
+		exit_code = 66;
+	}
+
+	free(path);
+	return exit_code;
+}
+
+// regular files below dir. links and anything else are left alone.
+static int walk_batch(struct batch *b, const char *dir, size_t rel) {
+	struct stat    st;
+	struct dirent *e;
+	DIR           *d;
+	int            exit_code = 0;
+
+	if ( !(d = opendir(dir)) ) {
+		fprintf(stderr, "Failed to open \"%s\" for reading.\n", dir);
+		return 66;
+	}
+
+	while ( !exit_code && (e = readdir(d)) ) {
+		if ( !strcmp(e->d_name, ".") || !strcmp(e->d_name, "..") )
+			continue;
+
+		char *path = join_path(dir, "/", e->d_name);
+		if ( !path ) {
+			fprintf(stderr, "Failed to allocate a buffer of %zu bytes.\n", strlen(dir) + strlen(e->d_name) + 2);
+			exit_code = 71;
+		} else if ( lstat(path, &st) ) {
+			fprintf(stderr, "Failed to open \"%s\" for reading.\n", path);
+			exit_code = 66;
+		} else if ( S_ISDIR(st.st_mode) ) {
+			exit_code = walk_batch(b, path, rel);
+		} else if ( S_ISREG(st.st_mode) ) {
+			exit_code = push_batch(b, path, rel, &st, false);
+		}
+		free(path);
+	}
+
+	closedir(d);
+	return exit_code;
+}
+
+// encrypted files end in .nenc. a walk passes over the others for -d and over them for -e.
+static int push_batch(struct batch *b, const char *path, size_t rel, const struct stat *st, bool named) {
+	size_t             len  = strlen(path);
+	bool               nenc = len > strlen(NENC_SUFFIX) && !strcmp(path + len - strlen(NENC_SUFFIX), NENC_SUFFIX);
+	struct batch_file *f;
+
+	if ( opts.op == ENCRYPT && nenc && !named )
+		return 0;
+
+	if ( opts.op == DECRYPT && !nenc ) {
+		if ( !named )
+			return 0;
+		fprintf(stderr, "Failed to decrypt \"%s\". Its name doesn't end in %s.\n", path, NENC_SUFFIX);
+		return 64;
+	}
+
+	if ( b->n == b->cap ) {
+		size_t cap = b->cap ? 2 * b->cap : 64;
+
+		if ( !(f = realloc(b->files, cap * sizeof(*f))) ) {
+			fprintf(stderr, "Failed to allocate a buffer of %zu bytes.\n", cap * sizeof(*f));
+			return 71;
+		}
+		b->files = f;
+		b->cap   = cap;
+	}
+
+	f       = &b->files[b->n];
+	f->size = st->st_size;
+	f->dev  = st->st_dev;
+	f->ino  = st->st_ino;
+	f->in   = strdup(path);
+	if ( opts.output )
+		f->out = join_path(opts.output, "/", path + rel);
+	else
+		f->out = strdup(path);
+
+	if ( !f->in || !f->out ) {
+		fprintf(stderr, "Failed to allocate a buffer of %zu bytes.\n", strlen(path) + 1);
+		free(f->in);
+		free(f->out);
+		return 71;
+	}
+
+	// the suffix is added or taken away
+	if ( opts.op == DECRYPT ) {
+		f->out[strlen(f->out) - strlen(NENC_SUFFIX)] = '\0';
+	} else {
+		char *out = join_path(f->out, NENC_SUFFIX, "");
+
+		free(f->out);
+		if ( !(f->out = out) ) {
+			fprintf(stderr, "Failed to allocate a buffer of %zu bytes.\n", strlen(path) + 1);
+			free(f->in);
+			return 71;
+		}
+	}
+
+	b->n++;
+	return 0;
+}
+
+// two jobs must never write the same output. without -O the output is named after the
+// input, so the same file given twice is found by its inode.
+static int check_batch(struct batch *b) {
+	qsort(b->files, b->n, sizeof(*b->files), by_output);
+
+	for ( size_t f = 1; f < b->n; f++ ) {
+		if ( !by_output(&b->files[f - 1], &b->files[f]) ) {
+			fprintf(stderr, "Failed to %s \"%s\" and \"%s\". Both go to \"%s\".\n", opts.op == ENCRYPT ? "encrypt" : "decrypt", b->files[f - 1].in, b->files[f].in, b->files[f].out);
+			return 64;
+		}
+	}
+
+	return 0;
+}
+
+static int by_output(const void *a, const void *b) {
+	const struct batch_file *x = a;
+	const struct batch_file *y = b;
+
+	if ( opts.output )
+		return strcmp(x->out, y->out);
+	if ( x->dev != y->dev )
+		return x->dev < y->dev ? -1 : 1;
+	if ( x->ino != y->ino )
+		return x->ino < y->ino ? -1 : 1;
+	return 0;
+}
+
+// the directories below -O an output goes to
+static int make_dirs(const char *path) {
+	char *p = strdup(path);
+	int   rc = 0;
+
+	if ( !p )
+		return -1;
+
+	for ( char *s = p + strlen(opts.output) + 1; rc == 0 && (s = strchr(s, '/')); s++ ) {
+		*s = '\0';
+		if ( mkdir(p, 0700) && errno != EEXIST )
+			rc = -1;
+		*s = '/';
+	}
+
+	free(p);
+	return rc;
+}
+
+static char *join_path(const char *a, const char *b, const char *c) {
+	char *p = malloc(strlen(a) + strlen(b) + strlen(c) + 1);
+
+	if ( p ) {
+		strcpy(p, a);
+		strcat(p, b);
+		strcat(p, c);
+	}
+
+	return p;
+}
+
+// cut the input into chunks. a chunk already in the store only gets one more reference.
+static int store_snapshot(struct input *in, const struct pk *pk, const struct sk *sk) {
+	struct store  st;
+	size_t        name_len = strlen(opts.snapshot);
+	uint8_t      *buf      = malloc(STORE_BUFFER);
+	uint8_t      *c        = malloc(SALT_LENGTH + MAC_LENGTH + CDC_MAX);
+	uint8_t      *m        = NULL;
+	uint8_t      *sealed   = NULL;
+	size_t        m_cap    = 0;
+	size_t        m_len    = MANIFEST_HEAD + name_len;
+	size_t        have     = 0;
+	size_t        pos      = 0;
+	uint64_t      length   = 0;
+	bool          eof      = false;
+	int           exit_code;
+
+	if ( !buf || !c ) {
+		fprintf(stderr, "Failed to allocate a buffer of %d bytes.\n", STORE_BUFFER);
+		free(c);
+		free(buf);
+		return 71;
+	}
+
+	if ( (exit_code = init_store(&st, pk, sk)) || (exit_code = grow_buf(&m, &m_cap, m_len)) || (exit_code = report_store(begin_store(true))) ) {
+		free(m);
+		free(c);
+		free(buf);
+		return exit_code;
+	}
+
+	// a cut needs CDC_MAX bytes in front of it unless the input ends earlier
+	while ( exit_code == 0 ) {
+		if ( !eof && have - pos < CDC_MAX ) {
+			memmove(buf, buf + pos, have - pos);
+			have -= pos;
+			pos   = 0;
+
+			size_t got = read_input(in, buf + have, STORE_BUFFER - have);
+			if ( in->failed ) {
+				fprintf(stderr, "Failed to store snapshot \"%s\". Read from %s failed.\n", opts.snapshot, in->name);
+				exit_code = 74;
+				break;
+			}
+			eof   = got < STORE_BUFFER - have;
+			have += got;
+		}
+
+		if ( pos == have )
+			break;
+
+		size_t n = cdc_cut(&st.cdc, buf + pos, have - pos);
+		if ( (exit_code = grow_buf(&m, &m_cap, m_len + MANIFEST_ENTRY)) )
+			break;
+
+		chunk_id(m + m_len, &st, buf + pos, n);
+		put_u32(m + m_len + CHUNK_ID_LENGTH, n);
+		exit_code = keep_chunk(&st, m + m_len, buf + pos, n, c);
+
+		m_len  += MANIFEST_ENTRY;
+		length += n;
+		pos    += n;
+	}
+
+	if ( exit_code == 0 ) {
+		put_u64(m, length);
+		put_u32(m + 8, name_len);
+		memcpy(m + MANIFEST_HEAD, opts.snapshot, name_len);
+
+		if ( !(sealed = malloc(SALT_LENGTH + MAC_LENGTH + m_len)) ) {
+			fprintf(stderr, "Failed to allocate a buffer of %zu bytes.\n", SALT_LENGTH + MAC_LENGTH + m_len);
+			exit_code = 71;
+		} else if ( seal_salted(sealed, m, m_len, 0, st.manifest) ) {
+			fprintf(stderr, "I'm to dumb to use crypto_secretbox().\n");
+			exit_code = 70;
+		} else {
+			switch ( add_snapshot(opts.snapshot, sealed, SALT_LENGTH + MAC_LENGTH + m_len) ) {
+				case NOT_STORED:
+					fprintf(stderr, "Failed to store snapshot \"%s\". There already is one of that name.\n", opts.snapshot);
+					exit_code = 73;
+					break;
+
+				default:
+					exit_code = report_store(OK);
+					break;
+			}
+		}
+	}
+
+	free(sealed);
+	free(m);
+	free(c);
+	free(buf);
+
+	if ( exit_code ) {
+		end_store(false);
+		return exit_code;
+	}
+	return report_store(end_store(true));
+}
+
+// every chunk is checked against its id before it is written
+static int restore_snapshot(struct output *out, const struct pk *pk, const struct sk *sk) {
+	struct store  st;
+	uint8_t      *m     = NULL;
+	uint8_t      *chunk = malloc(CDC_MAX);
+	size_t        len;
+	size_t        first;
+	int           exit_code;
+
+	if ( !chunk ) {
+		fprintf(stderr, "Failed to allocate a buffer of %d bytes.\n", CDC_MAX);
+		return 71;
+	}
+
+	if ( (exit_code = init_store(&st, pk, sk)) || (exit_code = report_store(begin_store(false))) ) {
+		free(chunk);
+		return exit_code;
+	}
+
+	if ( (exit_code = open_manifest(&st, &m, &len, &first)) == 0 ) {
+		for ( size_t i = first; exit_code == 0 && i < len; i += MANIFEST_ENTRY ) {
+			uint8_t  id[CHUNK_ID_LENGTH];
+			size_t   n = get_u32(m + i + CHUNK_ID_LENGTH);
+			void    *c = NULL;
+			size_t   c_len;
+			enum rc  rc;
+
+			if ( (rc = get_chunk(m + i, &c, &c_len)) == NOT_FOUND ) {
+				fprintf(stderr, "Failed to restore snapshot \"%s\". A chunk of it is missing.\n", opts.snapshot);
+				exit_code = 76;
+			} else if ( (exit_code = report_store(rc)) ) {
+				;
+			} else if ( c_len != SALT_LENGTH + MAC_LENGTH + n || open_salted(chunk, c, c_len, 0, st.chunk) || (chunk_id(id, &st, chunk, n), memcmp(id, m + i, CHUNK_ID_LENGTH)) ) {
+				fprintf(stderr, "Failed to restore snapshot \"%s\". A chunk of it is corrupted.\n", opts.snapshot);
+				exit_code = 76;
+			} else {
+				struct iovec iov = { .iov_base = chunk, .iov_len = n };
+
+				if ( write_output(out, &iov, 1) ) {
+					fprintf(stderr, "Failed to restore snapshot \"%s\". Write to %s failed.\n", opts.snapshot, out->name);
+					exit_code = 74;
+				}
+			}
+			free(c);
+		}
+	}
+
+	free(m);
+	free(chunk);
+	end_store(false);
+	return exit_code;
+}
+
+// one hash of the shared key per key, told apart by the last byte
+static int init_store(struct store *s, const struct pk *pk, const struct sk *sk) {
+	struct bk bk;
+	uint8_t   m[sizeof(bk.bk) + 1];
+	uint8_t   h[crypto_hash_BYTES];
+
+	if ( box_key(&bk, pk, sk) ) {
+		fprintf(stderr, "I'm to dumb to use crypto_box().\n");
+		return 70;
+	}
+
+	memcpy(m, bk.bk, sizeof(bk.bk));
+	m[sizeof(bk.bk)] = 'i';
+	crypto_hash(h, m, sizeof(m));
+	memcpy(s->id, h, KEY_LENGTH);
+
+	m[sizeof(bk.bk)] = 'c';
+	crypto_hash(h, m, sizeof(m));
+	memcpy(s->chunk, h, KEY_LENGTH);
+
+	m[sizeof(bk.bk)] = 'm';
+	crypto_hash(h, m, sizeof(m));
+	memcpy(s->manifest, h, KEY_LENGTH);
+
+	m[sizeof(bk.bk)] = 'g';
+	crypto_hash(h, m, sizeof(m));
+	cdc_init(&s->cdc, get_u64(h));
+
+	return 0;
+}
+
+// the key goes in front of a hash of the chunk, so the chunk is hashed where it is
+static void chunk_id(uint8_t *id, const struct store *s, const uint8_t *m, size_t len) {
+	uint8_t k[KEY_LENGTH + crypto_hash_BYTES];
+	uint8_t h[crypto_hash_BYTES];
+
+	memcpy(k, s->id, KEY_LENGTH);
+	crypto_hash(k + KEY_LENGTH, m, len);
+	crypto_hash(h, k, sizeof(k));
+	memcpy(id, h, CHUNK_ID_LENGTH);
+}
+
+// only a chunk the store lacks is sealed. c holds a sealed chunk of CDC_MAX bytes.
+static int keep_chunk(const struct store *s, const uint8_t *id, const uint8_t *m, size_t len, uint8_t *c) {
+	enum rc rc = ref_chunk(id);
+
+	if ( rc == NOT_FOUND ) {
+		if ( seal_salted(c, m, len, 0, s->chunk) ) {
+			fprintf(stderr, "I'm to dumb to use crypto_secretbox().\n");
+			return 70;
+		}
+		rc = add_chunk(id, c, SALT_LENGTH + MAC_LENGTH + len);
+	}
+
+	return report_store(rc);
+}
+
+// the entries of the manifest start at *first. the name and the length have to match.
+static int open_manifest(const struct store *s, uint8_t **m, size_t *len, size_t *first) {
+	void    *c;
+	size_t   c_len;
+	enum rc  rc;
+
+	if ( (rc = get_snapshot(opts.snapshot, &c, &c_len)) == NOT_FOUND ) {
+		fprintf(stderr, "There is no snapshot named \"%s\" in the database.\n", opts.snapshot);
+		return 66;
+	} else if ( rc != OK ) {
+		return report_store(rc);
+	}
+
+	if ( c_len < SALT_LENGTH + MAC_LENGTH + MANIFEST_HEAD || !(*m = malloc(c_len)) || open_salted(*m, c, c_len, 0, s->manifest) ) {
+		fprintf(stderr, "Failed to open snapshot \"%s\". It is corrupted or for other keys.\n", opts.snapshot);
+		free(*m);
+		*m = NULL;
+		free(c);
+		return 76;
+	}
+	free(c);
+
+	uint64_t length = 0;
+	size_t   n      = get_u32(*m + 8);
+
+	*len   = c_len - SALT_LENGTH - MAC_LENGTH;
+	*first = MANIFEST_HEAD + n;
+	if ( n != strlen(opts.snapshot) || *len < *first || memcmp(*m + MANIFEST_HEAD, opts.snapshot, n) || (*len - *first) % MANIFEST_ENTRY ) {
+		fprintf(stderr, "Failed to open snapshot \"%s\". The manifest is corrupted.\n", opts.snapshot);
+		return 76;
+	}
+
+	for ( size_t i = *first; i < *len && length != UINT64_MAX; i += MANIFEST_ENTRY ) {
+		size_t l = get_u32(*m + i + CHUNK_ID_LENGTH);
+
+		length = l == 0 || l > CDC_MAX ? UINT64_MAX : length + l;
+	}
+
+	if ( length != get_u64(*m) ) {
+		fprintf(stderr, "Failed to open snapshot \"%s\". The manifest is corrupted.\n", opts.snapshot);
+		return 76;
+	}
+
+	return 0;
+}
+
+static int report_store(enum rc rc) {
+	switch ( rc ) {
+		case OK:
+			return 0;
+
+		case DB_LOCKED:
+			fprintf(stderr, "Failed to use the chunk store. The database is locked.\n");
+			return 75;
+
+		case DB_BUSY:
+			fprintf(stderr, "Failed to use the chunk store. The database is busy.\n");
+			return 75;
+
+		default:
+			fprintf(stderr, "Failed to use the chunk store (rc = %i).\n", rc);
+			return 70;
+	}
+}
+
+// every record is sealed as a message of its own under a new data key. what crypto_box()
+// derives from the keys is the same for all of them and done once per recipient.
+static int seal_records(const struct pk *pk, unsigned n_pk, const struct sk *sk) {
+	struct bk      bk[n_pk];
+	struct input   in;
+	struct output  out;
+	size_t         bs    = opts.block_size ? opts.block_size : BS;
+	uint8_t       *m     = NULL;
+	uint8_t       *c     = NULL;
+	uint8_t       *box   = NULL;
+	size_t         m_cap = 0;
+	size_t         c_cap = 0;
+	size_t         b_cap = 0;
+	size_t         len;
+	bool           done;
+	int            exit_code;
+
+	for ( unsigned t = 0; t < n_pk; t++ ) {
+		if ( box_key(&bk[t], &pk[t], sk) ) {
+			fprintf(stderr, "I'm to dumb to use crypto_box().\n");
+			return 70;
+		}
+	}
+
+	if ( (exit_code = grow_buf(&box, &b_cap, 2 * RECORD_BOX(bs))) )
+		return exit_code;
+
+	if ( (exit_code = open_files(&in, &out)) ) {
+		free(box);
+		return exit_code;
+	}
+
+	for ( uint64_t n = 0; ; n++ ) {
+		if ( (exit_code = read_record(&in, &m, &m_cap, &len, RECORD_MAX, &done)) || done )
+			break;
+
+		size_t c_len = sealed_length(len, n_pk, bs);
+		if ( (exit_code = grow_buf(&c, &c_cap, c_len)) )
+			break;
+
+		if ( seal_record(c, m, len, bk, n_pk, bs, box) ) {
+			fprintf(stderr, "Failed to encrypt record #%" PRIu64 " from \"%s\" to \"%s\".\n", n, opts.source, opts.target);
+			exit_code = 70;
+			break;
+		}
+
+		if ( (exit_code = write_record(&out, c, c_len)) )
+			break;
+	}
+
+	free(box);
+	free(c);
+	free(m);
+	return close_files(&in, &out, exit_code);
+}
+
+static int open_records(const struct pk *pk, const struct sk *sk) {
+	struct bk      bk;
+	struct input   in;
+	struct output  out;
+	uint8_t       *m     = NULL;
+	uint8_t       *c     = NULL;
+	uint8_t       *box   = NULL;
+	size_t         m_cap = 0;
+	size_t         c_cap = 0;
+	size_t         b_cap = 0;
+	size_t         len;
+	size_t         c_len;
+	bool           done;
+	int            exit_code;
+
+	if ( box_key(&bk, pk, sk) ) {
+		fprintf(stderr, "I'm to dumb to use crypto_box().\n");
+		return 70;
+	}
+
+	if ( (exit_code = open_files(&in, &out)) )
+		return exit_code;
+
+	for ( uint64_t n = 0; ; n++ ) {
+		if ( (exit_code = read_record(&in, &c, &c_cap, &c_len, sealed_length(RECORD_MAX, MAX_RECIPIENTS, MIN_BS), &done)) || done )
+			break;
+
+		if ( (exit_code = grow_buf(&m, &m_cap, c_len)) || (exit_code = open_record(m, &len, c, c_len, &bk, n, &box, &b_cap)) )
+			break;
+
+		if ( (exit_code = write_record(&out, m, len)) )
+			break;
+	}
+
+	free(box);
+	free(c);
+	free(m);
+	return close_files(&in, &out, exit_code);
+}
+
+// the message encrypt_stream writes for len bytes without any options: compact for one
+// recipient, full blocks and a short final one otherwise. box is the scratch of
+// RECORD_BOX(bs) for the plaintext and as much for the box of every block.
+static int seal_record(uint8_t *c, const uint8_t *m, size_t len, const struct bk *bk, unsigned n_pk, size_t bs, uint8_t *box) {
+	struct pre  pre;
+	struct wrap wrap;
+	uint8_t     k[KEY_LENGTH];
+	uint8_t    *pc = box + RECORD_BOX(bs);
+
+	if ( n_pk == 1 && len <= COMPACT_MAX ) {
+		init_pre(&pre, FLAG_COMPACT, log_size(BS), 1);
+		memcpy(c, pre.pre, PRE_LENGTH);
+		return box_msg_bk(c + PRE_LENGTH, m, len, &pre, bk);
+	}
+
+	init_key(k);
+	init_pre(&pre, 0, log_size(bs), n_pk);
+	memcpy(c, pre.pre, PRE_LENGTH);
+	c += PRE_LENGTH;
+	for ( unsigned t = 0; t < n_pk; t++ ) {
+		if ( wrap_key_bk(&wrap, k, &pre, &bk[t]) )
+			return -1;
+		memcpy(c, wrap.wrap, WRAP_LENGTH);
+		c += WRAP_LENGTH;
+	}
+
+	for ( uint64_t i = 0; ; i++ ) {
+		size_t n = len < bs ? len : bs;
+
+		memcpy(box + crypto_secretbox_ZEROBYTES, m, n);
+		if ( seal_block_box(pc, box, n, i, k) )
+			return -1;
+		memcpy(c, pc + crypto_secretbox_BOXZEROBYTES, MAC_LENGTH + n);
+		c   += MAC_LENGTH + n;
+		m   += n;
+		len -= n;
+		if ( n < bs )
+			return 0;
+	}
+}
+
+// open what seal_record wrote. a plain stream from encrypt_stream reads the same. the
+// scratch in box grows to what its block size needs.
+static int open_record(uint8_t *m, size_t *len, const uint8_t *c, size_t c_len, const struct bk *bk, uint64_t n, uint8_t **box, size_t *box_cap) {
+	struct pre  pre;
+	struct wrap wrap;
+	uint8_t     k[KEY_LENGTH];
+	bool        found = false;
+	size_t      bs;
+	uint8_t    *pc;
+	int         exit_code;
+
+	if ( c_len < PRE_LENGTH ) {
+		fprintf(stderr, "Failed to decrypt record #%" PRIu64 " from \"%s\" to \"%s\". The message is truncated.\n", n, opts.source, opts.target);
+		return 76;
+	}
+
+	memcpy(pre.pre, c, PRE_LENGTH);
+	if ( !is_pre(&pre) || PRE_VERSION(&pre) != VERSION || (PRE_FLAGS(&pre) & ~FLAG_COMPACT) ) {
+		fprintf(stderr, "Failed to decrypt record #%" PRIu64 " from \"%s\" to \"%s\". The message uses features records don't support.\n", n, opts.source, opts.target);
+		return 76;
+	}
+
+	if ( PRE_FLAGS(&pre) == FLAG_COMPACT ) {
+		if ( PRE_RECIPIENTS(&pre) != 1 || unbox_msg_bk(m, c + PRE_LENGTH, c_len - PRE_LENGTH, &pre, bk) ) {
+			fprintf(stderr, "Failed to decrypt record #%" PRIu64 " from \"%s\" to \"%s\". The message is corrupted.\n", n, opts.source, opts.target);
+			return 76;
+		}
+		*len = c_len - PRE_LENGTH - COMPACT_LENGTH(0);
+		return 0;
+	}
+
+	if ( PRE_LOG_BS(&pre) >= sizeof(size_t) * 8 || ((size_t) 1 << PRE_LOG_BS(&pre)) < MIN_BS || ((size_t) 1 << PRE_LOG_BS(&pre)) > MAX_BS || PRE_RECIPIENTS(&pre) == 0 ) {
+		fprintf(stderr, "Failed to decrypt record #%" PRIu64 " from \"%s\" to \"%s\". The header is corrupted.\n", n, opts.source, opts.target);
+		return 76;
+	}
+
+	bs     = (size_t) 1 << PRE_LOG_BS(&pre);
+	c     += PRE_LENGTH;
+	c_len -= PRE_LENGTH;
+	if ( c_len < (size_t) PRE_RECIPIENTS(&pre) * WRAP_LENGTH ) {
+		fprintf(stderr, "Failed to decrypt record #%" PRIu64 " from \"%s\" to \"%s\". The message is truncated.\n", n, opts.source, opts.target);
+		return 76;
+	}
+
+	for ( unsigned r = 0; r < PRE_RECIPIENTS(&pre); r++ ) {
+		memcpy(wrap.wrap, c, WRAP_LENGTH);
+		if ( !found && unwrap_key_bk(k, &wrap, &pre, bk) == 0 )
+			found = true;
+		c     += WRAP_LENGTH;
+		c_len -= WRAP_LENGTH;
+	}
+
+	if ( !found ) {
+		fprintf(stderr, "Failed to decrypt record #%" PRIu64 " from \"%s\" to \"%s\". None of the %u recipients is \"%s\".\n", n, opts.source, opts.target, PRE_RECIPIENTS(&pre), opts.target);
+		return 76;
+	}
+
+	if ( (exit_code = grow_buf(box, box_cap, 2 * RECORD_BOX(bs))) )
+		return exit_code;
+	pc = *box + RECORD_BOX(bs);
+
+	// the final block is short. a full one at the end means blocks are missing.
+	*len = 0;
+	for ( uint64_t i = 0; ; i++ ) {
+		size_t b = c_len < bs + MAC_LENGTH ? c_len : bs + MAC_LENGTH;
+
+		if ( b < MAC_LENGTH || (b == c_len && b == bs + MAC_LENGTH) ) {
+			fprintf(stderr, "Failed to decrypt record #%" PRIu64 " from \"%s\" to \"%s\". The message is truncated.\n", n, opts.source, opts.target);
+			return 76;
+		}
+
+		memcpy(pc + crypto_secretbox_BOXZEROBYTES, c, b);
+		if ( open_block_box(*box, pc, b, i, k) ) {
+			fprintf(stderr, "Failed to decrypt record #%" PRIu64 " from \"%s\" to \"%s\". The block #%" PRIu64 " has an invalid MAC.\n", n, opts.source, opts.target, i);
+			return 76;
+		}
+
+		memcpy(m + *len, *box + crypto_secretbox_ZEROBYTES, b - MAC_LENGTH);
+		*len  += b - MAC_LENGTH;
+		c     += b;
+		c_len -= b;
+		if ( c_len == 0 )
+			return 0;
+	}
+}
+
+static size_t sealed_length(size_t len, unsigned n_pk, size_t bs) {
+	if ( n_pk == 1 && len <= COMPACT_MAX )
+		return PRE_LENGTH + COMPACT_LENGTH(len);
+
+	return PRE_LENGTH + n_pk * WRAP_LENGTH + len + (len / bs + 1) * MAC_LENGTH;
+}
+
+// the input may end in front of a record, not within one
+static int read_record(struct input *in, uint8_t **buf, size_t *cap, size_t *len, size_t max, bool *done) {
+	uint8_t p[RECORD_LENGTH];
+	size_t  got = read_input(in, p, RECORD_LENGTH);
+	int     exit_code;
+
+	*done = false;
+	if ( got == 0 && !in->failed ) {
+		*done = true;
+		return 0;
+	}
+
+	if ( got == RECORD_LENGTH && !in->failed ) {
+		if ( (*len = get_u32(p)) > max ) {
+			fprintf(stderr, "Failed to read a record from %s. The record of %zu bytes is larger than %zu bytes.\n", in->name, *len, max);
+			return 65;
+		}
+
+		if ( (exit_code = grow_buf(buf, cap, *len)) )
+			return exit_code;
+		got = read_input(in, *buf, *len);
+		if ( got == *len && !in->failed )
+			return 0;
+	}
+
+	if ( in->failed ) {
+		fprintf(stderr, "Failed to read a record from %s. Read failed.\n", in->name);
+		return 74;
+	}
+
+	fprintf(stderr, "Failed to read a record from %s. The record is truncated.\n", in->name);
+	return 65;
+}
+
+// length and record go out in one write. a reader on the other side of a pipe gets
+// every record as soon as it is done.
+static int write_record(struct output *out, const uint8_t *buf, size_t len) {
+	uint8_t      p[RECORD_LENGTH];
+	struct iovec iov[2] = {
+		{ .iov_base = p,               .iov_len = RECORD_LENGTH },
+		{ .iov_base = (uint8_t *) buf, .iov_len = len }
+	};
+
+	put_u32(p, len);
+	if ( write_output(out, iov, 2) ) {
+		fprintf(stderr, "Failed to write a record to %s. Write failed.\n", out->name);
+		return 74;
+	}
+
+	return 0;
+}
+
+static int grow_buf(uint8_t **buf, size_t *cap, size_t len) {
+	uint8_t *p;
+
+	if ( *buf && len <= *cap )
+		return 0;
+
+	if ( !(p = realloc(*buf, len ? len : 1)) ) {
+		fprintf(stderr, "Failed to allocate a buffer of %zu bytes.\n", len);
+		return 71;
+	}
+
+	*buf = p;
+	*cap = len;
+	return 0;
+}
+
+// continue the message in opts.append with the plaintext from in. the box key of sender
+// and recipient is the same from both sides, so the sender can open its own header.
+// the final block of an updatable message is opened and sealed again under a new salt
+// together with the new data.
+static int append_stream(struct input *in, const struct pk *pk, const struct sk *sk) {
+	struct input  msg;
+	struct output out;
+	struct pre    pre;
+	uint8_t       k[KEY_LENGTH];
+	size_t        bs;
+	unsigned      flags;
+	int           exit_code;
+
+	if ( open_input(&msg, opts.append, false) ) {
+		fprintf(stderr, "Failed to open \"%s\" for reading.\n", opts.append);
+		return 66;
+	}
+
+	if ( !msg.regular ) {
+		fprintf(stderr, "Failed to append to %s. It is not a regular file.\n", msg.name);
+		close_input(&msg);
+		return 66;
+	}
+
+	if ( (exit_code = read_key(&msg, &pre, k, &bs, &flags, pk, sk)) ) {
+		close_input(&msg);
+		return exit_code;
+	}
+
+	if ( flags & FLAG_COMPACT ) {
+		exit_code = append_compact(in, &msg, &pre, pk, sk);
+		close_input(&msg);
+		return exit_code;
+	}
+
+	// the last block and the footer are sealed under their counter already. sealing them
+	// again with more in them would use a nonce twice. only salted blocks take a new one.
+	if ( !(flags & FLAG_UPDATABLE) ) {
+		fprintf(stderr, "Failed to append to %s. Only messages encrypted with -U can be appended to.\n", msg.name);
+		close_input(&msg);
+		return 76;
+	}
+
+	size_t   bl   = bs + SALT_LENGTH + MAC_LENGTH;
+	uint64_t data = msg.size - msg.off;
+	uint64_t n    = data / bl + 1;
+	size_t   last = data % bl;
+
+	if ( last < SALT_LENGTH + MAC_LENGTH ) {
+		fprintf(stderr, "Failed to append to %s. The message is truncated.\n", msg.name);
+		close_input(&msg);
+		return 76;
+	}
+
+	if ( reopen_output(&out, opts.append) ) {
+		fprintf(stderr, "Failed to open \"%s\" for writing.\n", opts.append);
+		close_input(&msg);
+		return 73;
+	}
+
+	// the final block is sealed again under a new salt with the input behind what it holds
+	exit_code = update_blocks(in, &msg, &out, k, bs, n, last, (n - 1) * bs + last - SALT_LENGTH - MAC_LENGTH);
+	close_input(&msg);
+
+	if ( close_output(&out) && exit_code == 0 ) {
+		fprintf(stderr, "Failed to close %s.\n", out.name);
+		return 74;
+	}
+	return exit_code;
+}
+
+// a compact message turns into a stream with a data key. its plaintext is carried into
+// the first block and the whole file is written again beside it. it only takes the place
+// of the message once it is complete.
+static int append_compact(struct input *in, struct input *msg, const struct pre *pre, const struct pk *pk, const struct sk *sk) {
+	struct output out;
+	struct stream st;
+	uint8_t       m[COMPACT_MAX];
+	uint8_t       k[KEY_LENGTH];
+	uint8_t       head[PRE_LENGTH + WRAP_LENGTH];
+	size_t        len;
+	int           exit_code;
+
+	if ( (exit_code = read_compact(msg, pre, pk, sk, m, &len)) )
+		return exit_code;
+
+	init_key(k);
+	if ( make_head(head, k, 0, BS, pk, 1, sk) ) {
+		fprintf(stderr, "I'm to dumb to use crypto_box().\n");
+		return 70;
+	}
+
+	if ( open_replacement(&out, opts.append, false) ) {
+		fprintf(stderr, "Failed to open \"%s.new\" for writing.\n", opts.append);
+		return 73;
+	}
+
+	st.k         = k;
+	st.bs        = BS;
+	st.jobs      = opts.jobs;
+	st.depth     = opts.depth;
+	st.head      = head;
+	st.head_len  = sizeof(head);
+	st.first     = 0;
+	st.from      = 0;
+	st.to        = UINT64_MAX;
+	st.footer    = false;
+	st.carry     = m;
+	st.carry_len = len;
+	st.framed    = false;
+	st.latency   = 0;
+	st.flush     = 0;
+	st.pack      = false;
+	st.salted    = false;
+	st.save      = NULL;
+	st.save_arg  = NULL;
+
+	exit_code = report_seal(seal_blocks(in, &out, &st), in, &out);
+
+	if ( exit_code == 0 && finish_replacement(&out, opts.append) ) {
+		fprintf(stderr, "Failed to replace \"%s\".\n", opts.append);
+		exit_code = 74;
+	}
+
+	if ( close_output(&out) && exit_code == 0 ) {
+		fprintf(stderr, "Failed to close %s.\n", out.name);
+		exit_code = 74;
+	}
+	if ( exit_code )
+		drop_replacement(opts.append);
+	return exit_code;
+}
+
+static int report_seal(enum sc sc, const struct input *in, const struct output *out) {
+	switch ( sc ) {
+		case STREAM_OK:
+			return 0;
+
+		case STREAM_READ_FAILED:
+			fprintf(stderr, "Failed to encrypt message from \"%s\" to \"%s\". Read from %s failed.\n", opts.source, opts.target, in->name);
+			return 74;
+
+		case STREAM_WRITE_FAILED:
+			fprintf(stderr, "Failed to encrypt message from \"%s\" to \"%s\". Write to %s failed.\n", opts.source, opts.target, out->name);
+			return 74;
+
+		case STREAM_CRYPTO_FAILED:
+			fprintf(stderr, "I'm to dumb to use crypto_secretbox().\n");
+			return 70;
+
+		case STREAM_OVERFLOW:
+			fprintf(stderr, "You managed to encrypt 2^64 blocks -> Overflow :-(.");
+			return 70;
+
+		case STREAM_SAVE_FAILED:
+			fprintf(stderr, "Failed to encrypt message from \"%s\" to \"%s\". Write to checkpoint \"%s\" failed.\n", opts.source, opts.target, opts.checkpoint);
+			return 74;
+
+		case STREAM_NO_MEMORY:
+			fprintf(stderr, "Failed to allocate block buffers for %u jobs.\n", opts.jobs);
+			return 71;
+
+		default:
+			fprintf(stderr, "Failed to start %u worker threads.\n", opts.jobs);
+			return 71;
+	}
+}
+
+static int decrypt_stream(struct input *in, struct output *out, const struct pk *pk, const struct sk *sk, unsigned jobs) {
+	struct pre    pre;
+	struct stream st;
+	struct member member;
+	uint8_t       k[KEY_LENGTH];
+	unsigned      flags;
+	int           exit_code;
+
+	if ( (exit_code = read_key(in, &pre, k, &st.bs, &flags, pk, sk)) )
+		return exit_code;
+
+	if ( opts.member && !(flags & FLAG_ARCHIVE) ) {
+		fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". It is not an archive.\n", opts.source, opts.target);
+		return 76;
+	}
+
+	if ( flags & FLAG_COMPACT )
+		return decrypt_compact(in, out, &pre, pk, sk);
+
+	if ( input_eof(in) ) {
+		fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". The message is too short to be valid.\n", opts.source, opts.target);
+		return 76;
+	}
+
+	st.k        = k;
+	st.jobs     = jobs;
+	st.depth    = opts.depth;
+	st.head     = NULL;
+	st.head_len = 0;
+	st.first    = 0;
+	st.from     = opts.offset;
+	st.to       = opts.length > UINT64_MAX - opts.offset ? UINT64_MAX : opts.offset + opts.length;
+	st.footer   = flags & FLAG_FOOTER;
+	st.framed   = flags & FLAG_FRAMED;
+	st.pack     = flags & FLAG_PACKED;
+	st.salted   = flags & FLAG_UPDATABLE;
+
+	// blocks of a framed stream can't be found without reading all in front of them.
+	// packed blocks are all full, their frame headers lead to the range.
+	if ( st.framed && !st.pack && (st.from || st.to != UINT64_MAX) ) {
+		fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". A range can't be taken from a framed message.\n", opts.source, opts.target);
+		return 76;
+	}
+
+	// a member is a range of the archive. the index says where.
+	bool restore = false;
+	if ( flags & FLAG_ARCHIVE && out ) {
+		if ( !opts.member ) {
+			fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". It is an archive, name a member with -E.\n", opts.source, opts.target);
+			return 64;
+		}
+		if ( !in->regular ) {
+			fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". Members are only taken from an archive in a regular file.\n", opts.source, opts.target);
+			return 66;
+		}
+		if ( (exit_code = find_member(in, k, st.bs, opts.member, &member)) )
+			return exit_code;
+
+		st.from = member.off;
+		st.to   = member.off + member.len;
+		restore = opts.output != NULL;
+	}
+
+	if ( st.from == st.to )
+		return restore ? restore_member(out, &member) : 0;
+
+	// a seekable input goes straight to the first block of the range. if the range lies
+	// behind the end the last block is still opened.
+	if ( st.from && in->regular && !st.framed ) {
+		size_t   bl   = st.bs + MAC_LENGTH + (st.salted ? SALT_LENGTH : 0);
+		size_t   tail = st.footer ? FOOTER_LENGTH : 0;
+		uint64_t last = in->size > in->off + tail ? (in->size - in->off - tail) / bl : 0;
+
+		st.first = st.from / st.bs < last ? st.from / st.bs : last;
+		if ( skip_input(in, st.first * bl) ) {
+			fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". Read from %s failed.\n", opts.source, opts.target, in->name);
+			return 74;
+		}
+	}
+
+	// without an output only the MACs are checked
+	uint64_t i  = 0;
+	enum sc  sc = out ? open_blocks(in, out, &st, &i) : verify_blocks(in, &st, &i);
+
+	if ( sc == STREAM_OK && restore )
+		return restore_member(out, &member);
+	return report_open(sc, in, out, i);
+}
+
+static int report_open(enum sc sc, const struct input *in, const struct output *out, uint64_t i) {
+	switch ( sc ) {
+		case STREAM_OK:
+			return 0;
+
+		case STREAM_READ_FAILED:
+			fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". Read from %s failed.\n", opts.source, opts.target, in->name);
+			return 74;
+
+		case STREAM_WRITE_FAILED:
+			fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". Write to %s failed.\n", opts.source, opts.target, out->name);
+			return 74;
+
+		case STREAM_TOO_SHORT:
+			fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". The block #%" PRIu64 " is too short be valid.\n", opts.source, opts.target, i);
+			return 76;
+
+		case STREAM_BAD_MAC:
+			fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". The block #%" PRIu64 " has an invalid MAC.\n", opts.source, opts.target, i);
+			return 76;
+
+		case STREAM_TRUNCATED:
+			fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". The message is truncated.\n", opts.source, opts.target);
+			return 76;
+
+		case STREAM_BAD_FOOTER:
+			fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". The message is truncated or its footer is corrupted.\n", opts.source, opts.target);
+			return 76;
+
+		case STREAM_OVERFLOW:
+			fprintf(stderr, "You managed to decrypt 2^64 blocks -> Overflow :-(.");
+			return 70;
+
+		case STREAM_NO_MEMORY:
+			fprintf(stderr, "Failed to allocate block buffers for %u jobs.\n", opts.jobs);
+			return 71;
+
+		default:
+			fprintf(stderr, "Failed to start %u worker threads.\n", opts.jobs);
+			return 71;
+	}
+}
+
+// the index is found from the end of the plaintext. end is where the members stop.
+// the footer has to vouch for that end, an archive cut at a block boundary has other
+// bytes where the length of the index is read.
+static int read_index(struct input *in, const uint8_t *k, size_t bs, uint8_t **index, size_t *len, uint64_t *end) {
+	size_t   bl     = bs + MAC_LENGTH;
+	uint64_t data   = in->size > in->off + FOOTER_LENGTH ? in->size - in->off - FOOTER_LENGTH : 0;
+	uint64_t length = data / bl * bs + data % bl - MAC_LENGTH;
+	uint8_t  f[FOOTER_LENGTH];
+	uint64_t f_len, f_blocks;
+	size_t   f_bs;
+	uint8_t  tail[INDEX_TAIL];
+	int      exit_code;
+
+	if ( data % bl < MAC_LENGTH || length < INDEX_TAIL ) {
+		fprintf(stderr, "Failed to read the index of %s. The archive is truncated.\n", in->name);
+		return 76;
+	}
+
+	if ( read_input_at(in, f, FOOTER_LENGTH, in->size - FOOTER_LENGTH) != FOOTER_LENGTH || in->failed ) {
+		fprintf(stderr, "Failed to read %s. Read failed.\n", in->name);
+		return 74;
+	}
+
+	if ( open_footer(f, k, &f_len, &f_blocks, &f_bs) || f_len != length || f_blocks != data / bl + 1 || f_bs != bs ) {
+		fprintf(stderr, "Failed to read the index of %s. The archive is truncated or its footer is corrupted.\n", in->name);
+		return 76;
+	}
+
+	if ( (exit_code = read_plain(in, k, bs, length - INDEX_TAIL, tail, INDEX_TAIL)) )
+		return exit_code;
+
+	uint64_t n = get_u64(tail);
+	if ( n > length - INDEX_TAIL || n > SIZE_MAX ) {
+		fprintf(stderr, "Failed to read the index of %s. The archive is truncated.\n", in->name);
+		return 76;
+	}
+
+	if ( !(*index = malloc(n ? n : 1)) ) {
+		fprintf(stderr, "Failed to allocate a buffer of %" PRIu64 " bytes.\n", n);
+		return 71;
+	}
+
+	if ( (exit_code = read_plain(in, k, bs, length - INDEX_TAIL - n, *index, n)) ) {
+		free(*index);
+		return exit_code;
+	}
+
+	*len = n;
+	*end = length - INDEX_TAIL - n;
+	return 0;
+}
+
+// one entry of the index. returns where the next one starts or NULL if it is malformed.
+static const uint8_t *next_entry(const uint8_t *p, const uint8_t *end, uint64_t data, struct member *m) {
+	if ( (size_t) (end - p) < ENTRY_LENGTH )
+		return NULL;
+
+	m->off      = get_u64(p);
+	m->len      = get_u64(p + 8);
+	m->mtime    = get_u64(p + 16);
+	m->mode     = (uint32_t) p[24] << 24 | (uint32_t) p[25] << 16 | (uint32_t) p[26] << 8 | p[27];
+	m->path_len = (size_t) p[28] << 8 | p[29];
+	m->path     = (const char *) p + ENTRY_LENGTH;
+
+	if ( m->off > data || m->len > data - m->off || (size_t) (end - p) - ENTRY_LENGTH < m->path_len )
+		return NULL;
+
+	return p + ENTRY_LENGTH + m->path_len;
+}
+
+// a later entry of the same name replaces an earlier one
+static int find_member(struct input *in, const uint8_t *k, size_t bs, const char *name, struct member *m) {
+	struct member  e;
+	uint8_t       *index;
+	size_t         len;
+	uint64_t       data;
+	bool           found = false;
+	int            exit_code;
+
+	if ( (exit_code = read_index(in, k, bs, &index, &len, &data)) )
+		return exit_code;
+
+	for ( const uint8_t *p = index; p < index + len; ) {
+		if ( !(p = next_entry(p, index + len, data, &e)) ) {
+			fprintf(stderr, "Failed to read the index of %s. It is corrupted.\n", in->name);
+			free(index);
+			return 76;
+		}
+		if ( e.path_len == strlen(name) && !memcmp(e.path, name, e.path_len) ) {
+			*m    = e;
+			found = true;
+		}
+	}
+	free(index);
+
+	// the path points into the index. it is gone now.
+	m->path = NULL;
+	if ( !found ) {
+		fprintf(stderr, "There is no member \"%s\" in %s.\n", name, in->name);
+		return 66;
+	}
+
+	return 0;
+}
+
+// take len bytes at off from the plaintext of an archive. its blocks lie at fixed places
+// between the header and the footer.
+static int read_plain(struct input *in, const uint8_t *k, size_t bs, uint64_t off, uint8_t *buf, size_t len) {
+	size_t   bl  = bs + MAC_LENGTH;
+	uint64_t end = in->size > in->off + FOOTER_LENGTH ? in->size - FOOTER_LENGTH : in->off;
+	uint8_t *c   = malloc(bl);
+	uint8_t *m   = malloc(bs);
+	int      rc  = 0;
+
+	if ( !c || !m ) {
+		fprintf(stderr, "Failed to allocate a buffer of %zu bytes.\n", bl);
+		rc = 71;
+	}
+
+	for ( uint64_t i = off / bs; rc == 0 && len > 0; i++ ) {
+		uint64_t at_c = in->off + i * bl;
+		size_t   got  = at_c < end ? read_input_at(in, c, end - at_c < bl ? end - at_c : bl, at_c) : 0;
+		size_t   at   = off - i * bs;
+
+		if ( in->failed ) {
+			fprintf(stderr, "Failed to read %s. Read failed.\n", in->name);
+			rc = 74;
+		} else if ( got < MAC_LENGTH || open_block(m, c, got, i, k) ) {
+			fprintf(stderr, "Failed to read %s. The block #%" PRIu64 " has an invalid MAC.\n", in->name, i);
+			rc = 76;
+		} else if ( got - MAC_LENGTH <= at ) {
+			fprintf(stderr, "Failed to read %s. The message is truncated.\n", in->name);
+			rc = 76;
+		} else {
+			size_t n = got - MAC_LENGTH - at < len ? got - MAC_LENGTH - at : len;
+
+			memcpy(buf, m + at, n);
+			buf += n;
+			off += n;
+			len -= n;
+		}
+	}
+
+	free(m);
+	free(c);
+	return rc;
+}
+
+// an extracted file gets the mode and modification time it was archived with
+static int restore_member(struct output *out, const struct member *m) {
+	struct timespec ts[2] = {
+		{ .tv_sec = 0, .tv_nsec = UTIME_OMIT },
+		{ .tv_sec = m->mtime / 1000000000, .tv_nsec = m->mtime % 1000000000 }
+	};
+
+	if ( fchmod(out->fd, m->mode & 0777) || futimens(out->fd, ts) ) {
+		fprintf(stderr, "Failed to restore mode and modification time of %s.\n", out->name);
+		return 74;
+	}
+
+	return 0;
+}
+
+static unsigned log_size(size_t bs) {
+	unsigned log_bs = 0;
+
+	while ( ((size_t) 1 << log_bs) < bs )
+		log_bs++;
+	return log_bs;
+}
+
+// preamble and recipient table for PRE_LENGTH + n_pk * WRAP_LENGTH bytes of head
+static int make_head(uint8_t *head, const uint8_t *k, unsigned flags, size_t bs, const struct pk *pk, unsigned n_pk, const struct sk *sk) {
+	struct pre  pre;
+	struct wrap wrap;
+
+	init_pre(&pre, flags, log_size(bs), n_pk);
+	memcpy(head, pre.pre, PRE_LENGTH);
+	for ( unsigned t = 0; t < n_pk; t++ ) {
+		if ( wrap_key(&wrap, k, &pre, &pk[t], sk) )
+			return -1;
+		memcpy(head + PRE_LENGTH + t * WRAP_LENGTH, wrap.wrap, WRAP_LENGTH);
+	}
+
+	return 0;
+}
+
+// take the data key and the block size from either header format
+static int read_key(struct input *in, struct pre *pre, uint8_t *k, size_t *bs, unsigned *flags, const struct pk *pk, const struct sk *sk) {
+	struct hdr  hdr;
+	struct wrap wrap;
+
+	if ( read_input(in, pre->pre, PRE_LENGTH) != PRE_LENGTH || in->failed ) {
+		fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". Read from %s failed.\n", opts.source, opts.target, in->name);
+		return 74;
+	}
+
+	if ( is_pre(pre) && PRE_VERSION(pre) == VERSION ) {
+		unsigned f = PRE_FLAGS(pre);
+		if ( (f & ~(FLAG_FOOTER | FLAG_FRAMED | FLAG_COMPACT | FLAG_PACKED | FLAG_UPDATABLE | FLAG_ARCHIVE)) || (f & FLAG_FOOTER && f & FLAG_FRAMED) || (f & FLAG_COMPACT && f != FLAG_COMPACT) || (f & FLAG_PACKED && !(f & FLAG_FRAMED)) || (f & FLAG_UPDATABLE && f != FLAG_UPDATABLE) || (f & FLAG_ARCHIVE && f != (FLAG_ARCHIVE | FLAG_FOOTER)) ) {
+			fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". The message uses features this version does not support.\n", opts.source, opts.target);
+			return 76;
+		}
+
+		if ( PRE_LOG_BS(pre) >= sizeof(size_t) * 8 || ((size_t) 1 << PRE_LOG_BS(pre)) < MIN_BS || ((size_t) 1 << PRE_LOG_BS(pre)) > MAX_BS ) {
+			fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". The header is corrupted.\n", opts.source, opts.target);
+			return 76;
+		}
+
+		// a compact message has no recipient table. it is opened whole by read_compact.
+		if ( f & FLAG_COMPACT ) {
+			if ( PRE_RECIPIENTS(pre) != 1 ) {
+				fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". The header is corrupted.\n", opts.source, opts.target);
+				return 76;
+			}
+			*bs    = (size_t) 1 << PRE_LOG_BS(pre);
+			*flags = f;
+			return 0;
+		}
+
+		// look for our own wrap. the others are read past.
+		bool found = false;
+		for ( unsigned r = 0; r < PRE_RECIPIENTS(pre); r++ ) {
+			if ( read_input(in, wrap.wrap, WRAP_LENGTH) != WRAP_LENGTH || in->failed ) {
+				fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". Read from %s failed.\n", opts.source, opts.target, in->name);
+				return 74;
+			}
+			if ( !found && unwrap_key(k, &wrap, pre, pk, sk) == 0 )
+				found = true;
+		}
+
+		if ( !found && PRE_RECIPIENTS(pre) > 1 ) {
+			fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". None of the %u recipients is \"%s\".\n", opts.source, opts.target, PRE_RECIPIENTS(pre), opts.target);
+			return 76;
+		}
+
+		if ( !found ) {
+			fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". The header is corrupted.\n", opts.source, opts.target);
+			return 76;
+		}
+
+		*bs    = (size_t) 1 << PRE_LOG_BS(pre);
+		*flags = PRE_FLAGS(pre);
+		return 0;
+	}
+
+	// the original header starts with a random nonce. it may even look like an unknown version.
+	memcpy(hdr.hdr, pre->pre, PRE_LENGTH);
+	if ( read_input(in, hdr.hdr + PRE_LENGTH, sizeof(hdr.hdr) - PRE_LENGTH) != sizeof(hdr.hdr) - PRE_LENGTH || in->failed ) {
+		fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". Read from %s failed.\n", opts.source, opts.target, in->name);
+		return 74;
+	}
+
+	if ( dec_hdr(&hdr, pk, sk) ) {
+		if ( is_pre(pre) )
+			fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". The message format version %u is not supported.\n", opts.source, opts.target, PRE_VERSION(pre));
+		else
+			fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". The header is corrupted.\n", opts.source, opts.target);
+		return 76;
+	}
+
+	memcpy(k, &hdr.hdr[NONCE_LENGTH + MAC_LENGTH], KEY_LENGTH);
+	*bs    = BS;
+	*flags = 0;
+	return 0;
+}
+
+// pass the sealed blocks and the footer through unchanged
+static int copy_body(struct input *in, struct output *out, size_t bs) {
+	uint8_t *buf = malloc(bs);
+	size_t   len;
+	int      exit_code = 0;
+
+	if ( !buf ) {
+		fprintf(stderr, "Failed to allocate a buffer of %zu bytes.\n", bs);
+		return 71;
+	}
+
+	while ( (len = read_input(in, buf, bs)) > 0 ) {
+		struct iovec iov = { .iov_base = buf, .iov_len = len };
+
+		if ( write_output(out, &iov, 1) ) {
+			fprintf(stderr, "Failed to rewrap message from \"%s\" to \"%s\". Write to %s failed.\n", opts.source, opts.target, out->name);
+			exit_code = 74;
+			break;
+		}
+	}
+
+	if ( in->failed ) {
+		fprintf(stderr, "Failed to rewrap message from \"%s\" to \"%s\". Read from %s failed.\n", opts.source, opts.target, in->name);
+		exit_code = 74;
+	}
+
+	free(buf);
+	return exit_code;
+}
+
+// the rest of a compact message. more than fits is as wrong as a bad MAC.
+static int read_compact(struct input *in, const struct pre *pre, const struct pk *pk, const struct sk *sk, uint8_t *m, size_t *len) {
+	uint8_t c[COMPACT_LENGTH(COMPACT_MAX) + 1];
+	size_t  n = read_input(in, c, sizeof(c));
+
+	if ( in->failed ) {
+		fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". Read from %s failed.\n", opts.source, opts.target, in->name);
+		return 74;
+	}
+
+	if ( unbox_msg(m, c, n, pre, pk, sk) ) {
+		fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". The message is corrupted.\n", opts.source, opts.target);
+		return 76;
+	}
+
+	*len = n - COMPACT_LENGTH(0);
+	return 0;
+}
+
+static int seal_compact(struct output *out, const uint8_t *m, size_t len, const struct pk *pk, const struct sk *sk) {
+	struct pre pre;
+	uint8_t    c[PRE_LENGTH + COMPACT_LENGTH(COMPACT_MAX)];
+
+	init_pre(&pre, FLAG_COMPACT, log_size(BS), 1);
+	memcpy(c, pre.pre, PRE_LENGTH);
+	if ( box_msg(c + PRE_LENGTH, m, len, &pre, pk, sk) ) {
+		fprintf(stderr, "I'm to dumb to use crypto_box().\n");
+		return 70;
+	}
+
+	struct iovec iov = { .iov_base = c, .iov_len = PRE_LENGTH + COMPACT_LENGTH(len) };
+	if ( write_output(out, &iov, 1) ) {
+		fprintf(stderr, "Failed to encrypt message from \"%s\" to \"%s\". Write to %s failed.\n", opts.source, opts.target, out->name);
+		return 74;
+	}
+
+	return 0;
+}
+
+// without an output the message is only checked
+static int decrypt_compact(struct input *in, struct output *out, const struct pre *pre, const struct pk *pk, const struct sk *sk) {
+	uint8_t m[COMPACT_MAX];
+	size_t  len;
+	int     exit_code;
+
+	if ( (exit_code = read_compact(in, pre, pk, sk, m, &len)) || !out )
+		return exit_code;
+
+	uint64_t from = opts.offset < len ? opts.offset : len;
+	uint64_t to   = opts.length < len - from ? from + opts.length : len;
+
+	struct iovec iov = { .iov_base = m + from, .iov_len = to - from };
+	if ( write_output(out, &iov, 1) ) {
+		fprintf(stderr, "Failed to decrypt message from \"%s\" to \"%s\". Write to %s failed.\n", opts.source, opts.target, out->name);
+		return 74;
+	}
+
+	return 0;
+}
+
+static int open_files(struct input *in, struct output *out) {
+	// with a queue depth regular files are read at their offsets instead of mapped
+	if ( open_input(in, opts.input, !opts.depth) ) {
+		fprintf(stderr, "Failed to open \"%s\" for reading.\n", opts.input);
+		return 66;
+	}
+
+	if ( open_output(out, opts.output, opts.zero_copy) ) {
+		fprintf(stderr, "Failed to open \"%s\" for writing.\n", opts.output);
+		close_input(in);
+		return 73;
+	}
+
+	return 0;
+}
+
+static int close_files(struct input *in, struct output *out, int exit_code) {
+	close_input(in);
+
+	if ( close_output(out) && exit_code == 0 ) {
+		fprintf(stderr, "Failed to close %s.\n", out->name);
+		return 74;
+	}
+
+	return exit_code;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+	for ( int i = 3; i >= 0; i-- ) {
+		p[i]   = v;
+		v    >>= 8;
+	}
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+	uint32_t v = 0;
+
+	for ( int i = 0; i < 4; i++ )
+		v = v << 8 | p[i];
+	return v;
+}
+
+static void put_u64(uint8_t *p, uint64_t v) {
+	for ( int i = 7; i >= 0; i-- ) {
+		p[i]   = v;
+		v    >>= 8;
+	}
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+	uint64_t v = 0;
+
+	for ( int i = 0; i < 8; i++ )
+		v = v << 8 | p[i];
+	return v;
 }
@@ -1,26 +1,63 @@
 #include "opts.h"
 #include "db.h"
+#include "stream.h"
+#include "vfs.h"
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 
+#define MAX_JOBS  (256)
+#define MAX_DEPTH (256)
+#define MAX_LATENCY (3600000)
+
 struct opts opts = {
 	.op = NOP,
 	.target      = NULL,
+	.n_targets   = 0,
+	.new_source  = NULL,
+	.n_new_targets = 0,
 	.source      = NULL,
 	.name        = NULL,
+	.input       = NULL,
+	.output      = NULL,
+	.append      = NULL,
+	.checkpoint  = NULL,
+	.update      = NULL,
+	.member      = NULL,
+	.snapshot    = NULL,
+	.query       = NULL,
+	.files       = NULL,
+	.n_files     = 0,
+	.jobs        = 1,
+	.depth       = 0,
+	.block_size  = 0,
+	.latency     = 0,
+	.flush       = 0,
+	.offset      = 0,
+	.length      = UINT64_MAX,
 	.force       = false,
 	.use_public  = false,
-	.use_private = false
+	.use_private = false,
+	.zero_copy   = false,
+	.footer      = false,
+	.pack        = false,
+	.resume      = false,
+	.updatable   = false,
+	.archive     = false,
+	.records     = false
 };
 
-static void usage(int argc, char **argv);
+static void     usage(int argc, char **argv);
+static unsigned parse_count(int argc, char **argv, const char *arg, unsigned long max);
+static size_t   parse_size(int argc, char **argv, const char *arg);
+static uint64_t parse_bytes(int argc, char **argv, const char *arg);
 
 char *parse_args(int *argc, char ***argv) {
 	int   ch;
 	char *env;
-	while ( (ch = getopt(*argc, *argv, "fpPedlg:x:i:r:s:t:")) != -1 ) {
+	while ( (ch = getopt(*argc, *argv, "fpPedqVwlZFzCUABg:x:i:r:a:c:u:E:k:R:X:s:t:S:T:j:Q:b:m:M:o:n:I:O:")) != -1 ) {
         	switch ( ch ) {
                 	case 'f':
 				opts.force = true;
@@ -34,6 +71,67 @@ char *parse_args(int *argc, char ***argv) {
 				opts.use_private = true;
 				break;
 
+			case 'Z':
+				opts.zero_copy = true;
+				break;
+
+			case 'F':
+				opts.footer = true;
+				break;
+
+			case 'z':
+				opts.pack = true;
+				break;
+
+			case 'C':
+				opts.resume = true;
+				break;
+
+			case 'U':
+				opts.updatable = true;
+				break;
+
+			case 'A':
+				opts.archive = true;
+				break;
+
+			case 'B':
+				opts.records = true;
+				break;
+
+			case 'E':
+				if ( opts.member != NULL )
+					usage(*argc, *argv);
+				opts.member = optarg;
+				break;
+
+			case 'k':
+				if ( opts.snapshot != NULL )
+					usage(*argc, *argv);
+				opts.snapshot = optarg;
+				break;
+
+			case 'R':
+				if ( opts.op != NOP || opts.snapshot != NULL )
+					usage(*argc, *argv);
+				opts.op       = FORGET;
+				opts.snapshot = optarg;
+				break;
+
+			case 'X':
+				if ( opts.op != NOP )
+					usage(*argc, *argv);
+				opts.op    = QUERY;
+				opts.query = optarg;
+				break;
+
+			case 'u':
+				if ( opts.op != NOP )
+					usage(*argc, *argv);
+				opts.op     = UPDATE;
+				opts.update = optarg;
+				break;
+
 			case 'e':
 				if ( opts.op != NOP )
 					usage(*argc, *argv);
@@ -46,6 +144,24 @@ char *parse_args(int *argc, char ***argv) {
 				opts.op = DECRYPT;
 				break;
 
+			case 'q':
+				if ( opts.op != NOP )
+					usage(*argc, *argv);
+				opts.op = INSPECT;
+				break;
+
+			case 'V':
+				if ( opts.op != NOP )
+					usage(*argc, *argv);
+				opts.op = VERIFY;
+				break;
+
+			case 'w':
+				if ( opts.op != NOP )
+					usage(*argc, *argv);
+				opts.op = REWRAP;
+				break;
+
 			case 'l':
 				if ( opts.op != NOP )
 					usage(*argc, *argv);
@@ -86,10 +202,77 @@ char *parse_args(int *argc, char ***argv) {
 				opts.source = optarg;
 				break;
 			
+			// encryption takes several recipients. everything else only the first.
 			case 't':
-				if ( opts.target != NULL )
+				if ( opts.n_targets == MAX_RECIPIENTS )
+					usage(*argc, *argv);
+				opts.targets[opts.n_targets++] = optarg;
+				opts.target = opts.targets[0];
+				break;
+
+			case 'a':
+				if ( opts.append != NULL )
+					usage(*argc, *argv);
+				opts.append = optarg;
+				break;
+
+			case 'c':
+				if ( opts.checkpoint != NULL )
+					usage(*argc, *argv);
+				opts.checkpoint = optarg;
+				break;
+
+			case 'S':
+				if ( opts.new_source != NULL )
+					usage(*argc, *argv);
+				opts.new_source = optarg;
+				break;
+
+			case 'T':
+				if ( opts.n_new_targets == MAX_RECIPIENTS )
+					usage(*argc, *argv);
+				opts.new_targets[opts.n_new_targets++] = optarg;
+				break;
+
+			case 'j':
+				opts.jobs = parse_count(*argc, *argv, optarg, MAX_JOBS);
+				break;
+
+			case 'Q':
+				opts.depth = parse_count(*argc, *argv, optarg, MAX_DEPTH);
+				break;
+
+			case 'b':
+				opts.block_size = parse_size(*argc, *argv, optarg);
+				break;
+
+			case 'm':
+				opts.latency = parse_count(*argc, *argv, optarg, MAX_LATENCY);
+				break;
+
+			case 'M':
+				if ( (opts.flush = parse_bytes(*argc, *argv, optarg)) == 0 )
+					usage(*argc, *argv);
+				break;
+
+			case 'o':
+				opts.offset = parse_bytes(*argc, *argv, optarg);
+				break;
+
+			case 'n':
+				opts.length = parse_bytes(*argc, *argv, optarg);
+				break;
+
+			case 'I':
+				if ( opts.input != NULL )
 					usage(*argc, *argv);
-				opts.target = optarg;
+				opts.input = optarg;
+				break;
+
+			case 'O':
+				if ( opts.output != NULL )
+					usage(*argc, *argv);
+				opts.output = optarg;
 				break;
 			
 			default:
@@ -98,12 +281,93 @@ char *parse_args(int *argc, char ***argv) {
 	}
 
 	
+	if ( opts.zero_copy && opts.op != ENCRYPT && opts.op != DECRYPT )
+		usage(*argc, *argv);
+
+	if ( opts.output && opts.op != ENCRYPT && opts.op != DECRYPT && opts.op != REWRAP )
+		usage(*argc, *argv);
+
+	if ( (opts.jobs != 1 || opts.depth) && opts.op != ENCRYPT && opts.op != DECRYPT && opts.op != VERIFY )
+		usage(*argc, *argv);
+
+	if ( opts.input && opts.op != ENCRYPT && opts.op != DECRYPT && opts.op != INSPECT && opts.op != VERIFY && opts.op != REWRAP && opts.op != UPDATE && opts.op != QUERY )
+		usage(*argc, *argv);
+
+	// an appended message keeps its header. it was written for its recipients already.
+	if ( opts.append && (opts.op != ENCRYPT || opts.output || opts.block_size || opts.footer || opts.zero_copy || opts.n_targets > 1 || opts.jobs != 1 || opts.depth) )
+		usage(*argc, *argv);
+
+	// the new sender and the new recipients of a rewrapped message
+	if ( (opts.new_source || opts.n_new_targets) && opts.op != REWRAP )
+		usage(*argc, *argv);
+
+	// the block size of a message is recorded in its header
+	if ( (opts.block_size && opts.op != ENCRYPT && opts.op != QUERY) || ((opts.footer || opts.n_targets > 1) && opts.op != ENCRYPT) )
+		usage(*argc, *argv);
+
+	// every page of a database is sealed on its own. a block is a sector to SQLite.
+	if ( opts.op == QUERY && opts.block_size > VFS_MAX_BS )
+		usage(*argc, *argv);
+
+	// a framed stream marks its final block itself. there is no footer behind it.
+	if ( (opts.latency || opts.flush) && (opts.op != ENCRYPT || opts.footer || opts.append) )
+		usage(*argc, *argv);
+
+	// packed blocks are framed and always full. they can't be flushed early.
+	if ( opts.pack && (opts.op != ENCRYPT || opts.footer || opts.append || opts.latency || opts.flush) )
+		usage(*argc, *argv);
+
+	// a checkpoint counts blocks of a file written to a file. a resumed job takes its
+	// block size and format from the header in the checkpoint.
+	if ( opts.checkpoint && (opts.op != ENCRYPT || !opts.input || !opts.output || opts.append) )
+		usage(*argc, *argv);
+
+	if ( opts.resume && (!opts.checkpoint || opts.block_size || opts.footer || opts.pack || opts.latency || opts.flush) )
+		usage(*argc, *argv);
+
+	if ( (opts.offset && opts.op != DECRYPT && opts.op != UPDATE) || (opts.length != UINT64_MAX && opts.op != DECRYPT) )
+		usage(*argc, *argv);
+
+	// updatable blocks have a fixed place in the file. nothing else changes their length.
+	if ( opts.updatable && (opts.op != ENCRYPT || opts.footer || opts.pack || opts.latency || opts.flush || opts.append || opts.resume) )
+		usage(*argc, *argv);
+
+	// the members of an archive are named in its input. they are taken out one at a time.
+	// it always ends in a footer, -F adds nothing.
+	if ( opts.archive && (opts.op != ENCRYPT || opts.footer || opts.pack || opts.latency || opts.flush || opts.append || opts.checkpoint || opts.updatable) )
+		usage(*argc, *argv);
+
+	if ( opts.member && (opts.op != DECRYPT || opts.offset || opts.length != UINT64_MAX) )
+		usage(*argc, *argv);
+
+	// every record is a message of its own. it is sealed and opened whole in memory.
+	if ( opts.records && ((opts.op != ENCRYPT && opts.op != DECRYPT) || opts.jobs != 1 || opts.depth || opts.zero_copy || opts.footer || opts.pack || opts.latency || opts.flush || opts.append || opts.checkpoint || opts.updatable || opts.archive || opts.member || opts.offset || opts.length != UINT64_MAX) )
+		usage(*argc, *argv);
+
+	// a snapshot is cut into chunks and only the ones the store lacks are sealed. it has
+	// one recipient, the pair of keys finds its chunks.
+	if ( opts.snapshot && (opts.op == ENCRYPT || opts.op == DECRYPT) && ((opts.op == ENCRYPT && opts.output) || (opts.op == DECRYPT && opts.input) || opts.n_targets > 1 || opts.jobs != 1 || opts.depth || opts.zero_copy || opts.block_size || opts.footer || opts.pack || opts.latency || opts.flush || opts.append || opts.checkpoint || opts.updatable || opts.archive || opts.records || opts.member || opts.offset || opts.length != UINT64_MAX) )
+		usage(*argc, *argv);
+
+	if ( opts.snapshot && opts.op != ENCRYPT && opts.op != DECRYPT && opts.op != FORGET )
+		usage(*argc, *argv);
+
 	switch ( opts.op ) {
 		case ENCRYPT:
 		case DECRYPT:
+		case INSPECT:
+		case VERIFY:
+		case UPDATE:
+		case FORGET:
+		case QUERY:
 			if ( opts.force || opts.use_public || opts.use_private || opts.source == NULL || opts.target == NULL || opts.name != NULL )
 				usage(*argc, *argv);
 			break;
+
+		case REWRAP:
+			if ( opts.force || opts.use_public || opts.use_private || opts.source == NULL || opts.target == NULL || opts.name != NULL || opts.n_new_targets == 0 )
+				usage(*argc, *argv);
+			break;
 			
 		case GENERATE_KEY:
 			if ( opts.use_public || opts.use_private || opts.source != NULL || opts.target != NULL || opts.name == NULL )
@@ -135,14 +399,91 @@ char *parse_args(int *argc, char ***argv) {
 
 	env = getenv("NACLCRYPT_DB");
 
-	int left_args = *argc - optind;
-	if ( (!env && left_args != 1) || (env && left_args != 0 && left_args != 1 ) )
+	int    left_args = *argc - optind;
+	char **args      = *argv + optind;
+
+	if ( (!env && left_args < 1) || (env && left_args > 1 && opts.op != ENCRYPT && opts.op != DECRYPT) )
 		usage(*argc, *argv);
-	
+
+	// files follow the database. with the database in the environment every argument
+	// to -e and -d is a file.
+	char *db = env;
+	if ( !env || (left_args == 1 && opts.op != ENCRYPT && opts.op != DECRYPT) ) {
+		db = *args++;
+		left_args--;
+	}
+
+	// a batch reads its files and writes next to them or into the directory -O
+	if ( left_args ) {
+		if ( (opts.op != ENCRYPT && opts.op != DECRYPT) || opts.input || opts.append || opts.checkpoint || opts.archive || opts.records || opts.snapshot || opts.member || opts.offset || opts.length != UINT64_MAX )
+			usage(*argc, *argv);
+		opts.files   = args;
+		opts.n_files = left_args;
+	}
+
 	*argc -= optind;
 	*argv += optind;
-	
-	return *argc == 1 ? *argv[0] : env;
+
+	return db;
+}
+
+static unsigned parse_count(int argc, char **argv, const char *arg, unsigned long max) {
+	char          *end;
+	unsigned long  n;
+
+	errno = 0;
+	n     = strtoul(arg, &end, 10);
+	if ( errno || end == arg || *end != '\0' || n < 1 || n > max )
+		usage(argc, argv);
+
+	return n;
+}
+
+// a power of two from MIN_BS to MAX_BS
+static size_t parse_size(int argc, char **argv, const char *arg) {
+	uint64_t size = parse_bytes(argc, argv, arg);
+
+	if ( size < MIN_BS || size > MAX_BS || (size & (size - 1)) )
+		usage(argc, argv);
+
+	return size;
+}
+
+// a byte count. k, m and g multiply by powers of 1024.
+static uint64_t parse_bytes(int argc, char **argv, const char *arg) {
+	char               *end;
+	unsigned long long  n;
+	unsigned            shift = 0;
+
+	errno = 0;
+	n     = strtoull(arg, &end, 10);
+	if ( errno || end == arg || *arg == '-' )
+		usage(argc, argv);
+
+	switch ( *end ) {
+		case 'k':
+		case 'K':
+			shift = 10;
+			end++;
+			break;
+
+		case 'm':
+		case 'M':
+			shift = 20;
+			end++;
+			break;
+
+		case 'g':
+		case 'G':
+			shift = 30;
+			end++;
+			break;
+	}
+
+	if ( *end != '\0' || n > (UINT64_MAX >> shift) )
+		usage(argc, argv);
+
+	return (uint64_t) n << shift;
 }
 
 static void usage(int argc, char **argv) {
@@ -152,11 +493,33 @@ static void usage(int argc, char **argv) {
 		"       %s [-p] [-P] -x <name> <db>\n"
 		"       %s [-f] [-p] [-P] -i <name> <db>\n"
 		"       %s [-f] [-p] [-P] -r <name> <db>\n"
-		"       %s -e -s <name> -t <name> <db>\n"
-		"       %s -d -t <name> -s <name> <db>\n"
+		"       %s -e [-Z] [-j <jobs>] [-Q <depth>] [-b <size>] [-F | -z | -m <ms> | -M <bytes>] [-c <file>] [-I <in>] [-O <out>] -s <name> -t <name> [-t <name> ...] <db>\n"
+		"       %s -e -C -c <file> [-Z] [-j <jobs>] [-Q <depth>] -I <in> -O <out> -s <name> -t <name> [-t <name> ...] <db>\n"
+		"       %s -e -U [-Z] [-j <jobs>] [-Q <depth>] [-b <size>] [-c <file>] [-I <in>] [-O <out>] -s <name> -t <name> [-t <name> ...] <db>\n"
+		"       %s -u <file> [-o <offset>] [-I <in>] -s <name> -t <name> <db>\n"
+		"       %s -e -A [-Z] [-j <jobs>] [-Q <depth>] [-b <size>] [-I <list>] [-O <out>] -s <name> -t <name> [-t <name> ...] <db>\n"
+		"       %s -e -B [-b <size>] [-I <in>] [-O <out>] -s <name> -t <name> [-t <name> ...] <db>\n"
+		"       %s -e -k <snapshot> [-I <in>] -s <name> -t <name> <db>\n"
+		"       %s -e -a <file> [-I <in>] -s <name> -t <name> <db>\n"
+		"       %s -d [-Z] [-j <jobs>] [-Q <depth>] [-E <member> | [-o <offset>] [-n <length>]] [-I <in>] [-O <out>] -t <name> -s <name> <db>\n"
+		"       %s -d -B [-I <in>] [-O <out>] -t <name> -s <name> <db>\n"
+		"       %s -d -k <snapshot> [-O <out>] -t <name> -s <name> <db>\n"
+		"       %s -R <snapshot> -t <name> -s <name> <db>\n"
+		"       %s -V [-j <jobs>] [-Q <depth>] [-I <in>] -t <name> -s <name> <db>\n"
+		"       %s -w [-I <in>] [-O <out>] -t <name> -s <name> [-S <name>] -T <name> [-T <name> ...] <db>\n"
+		"       %s -q [-I <in>] -t <name> -s <name> <db>\n"
+		"       %s -X <database> [-b <size>] [-I <sql>] -s <name> -t <name> <db>\n"
 		"       %s [-p] [-P] -l <db>\n"
-		"	<db> can be replaced by NACLCRYPT_DB=<db>\n",
-		argv0, argv0, argv0, argv0, argv0, argv0, argv0
+		"	<db> can be replaced by NACLCRYPT_DB=<db>\n"
+		"	-e and -d take files and directories behind <db>. <file> goes to <file>.nenc and\n"
+		"	back, or into the directory -O.\n"
+		"	-B reads records of a 4 byte big endian length and that many bytes. every record\n"
+		"	is sealed or opened as a message of its own and written as a record again.\n"
+		"	-k keeps the input as a snapshot in the chunk store of <db>. only chunks the store\n"
+		"	lacks are added. -R drops a snapshot and the chunks nothing else refers to.\n"
+		"	-X runs the SQL of the input on <database>. every page of it is sealed on its own,\n"
+		"	-d opens it whole. -b sets the page size of a new database.\n",
+		argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0
 	);
 	exit(64);
 }
@@ -0,0 +1,108 @@
+#include "ring.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// how often a side looks at the ring again before it goes to sleep
+#define SPIN (64)
+
+static bool can_put(struct ring *r);
+static bool can_get(struct ring *r);
+static void wait_for(struct ring *r, bool (*ready)(struct ring *), int *waits, sem_t *sem);
+static void wake(int *waits, sem_t *sem);
+
+int ring_init(struct ring *r, size_t size) {
+	r->size      = size;
+	r->head      = 0;
+	r->tail      = 0;
+	r->put_waits = 0;
+	r->get_waits = 0;
+
+	if ( !(r->items = calloc(size, sizeof(void *))) )
+		return -1;
+
+	if ( sem_init(&r->room, 0, 0) ) {
+		free(r->items);
+		return -1;
+	}
+
+	if ( sem_init(&r->data, 0, 0) ) {
+		sem_destroy(&r->room);
+		free(r->items);
+		return -1;
+	}
+
+	return 0;
+}
+
+void ring_destroy(struct ring *r) {
+	sem_destroy(&r->data);
+	sem_destroy(&r->room);
+	free(r->items);
+}
+
+// head and tail only grow. the entry is at the index modulo the size.
+void ring_put(struct ring *r, void *item) {
+	size_t head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+
+	if ( !can_put(r) )
+		wait_for(r, can_put, &r->put_waits, &r->room);
+	r->items[head % r->size] = item;
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+	wake(&r->get_waits, &r->data);
+}
+
+void *ring_get(struct ring *r) {
+	if ( !can_get(r) )
+		wait_for(r, can_get, &r->get_waits, &r->data);
+
+	return ring_try(r);
+}
+
+// like ring_get but returns NULL instead of blocking on an empty ring
+void *ring_try(struct ring *r) {
+	size_t  tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+	void   *item;
+
+	if ( !can_get(r) )
+		return NULL;
+	item = r->items[tail % r->size];
+	__atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+	wake(&r->put_waits, &r->room);
+
+	return item;
+}
+
+static bool can_put(struct ring *r) {
+	return __atomic_load_n(&r->head, __ATOMIC_RELAXED) - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) < r->size;
+}
+
+static bool can_get(struct ring *r) {
+	return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) != __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+}
+
+// the fence keeps the check behind the flag. the other side fences between its store and
+// the look at the flag, so one of the two always sees the other. a post left over from an
+// earlier wait only costs another round.
+static void wait_for(struct ring *r, bool (*ready)(struct ring *), int *waits, sem_t *sem) {
+	for ( unsigned n = 0; n < SPIN; n++ ) {
+		if ( ready(r) )
+			return;
+	}
+
+	for ( ;; ) {
+		__atomic_store_n(waits, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if ( ready(r) )
+			break;
+		while ( sem_wait(sem) && errno == EINTR );
+	}
+	__atomic_store_n(waits, 0, __ATOMIC_RELAXED);
+}
+
+static void wake(int *waits, sem_t *sem) {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if ( __atomic_load_n(waits, __ATOMIC_RELAXED) && __atomic_exchange_n(waits, 0, __ATOMIC_RELAXED) )
+		sem_post(sem);
+}
@@ -0,0 +1,28 @@
+#ifndef _NACL_CRYPT_RING_H
+#define _NACL_CRYPT_RING_H
+
+#include <stddef.h>
+#include <semaphore.h>
+
+// bounded single producer single consumer queue of pointers.
+// head is only written by the producer, tail only by the consumer. an entry is handed
+// over with atomic loads and stores of the two. a side that found the ring full or empty
+// for a while sleeps on its semaphore until the other side moves.
+typedef struct ring {
+	void   **items;
+	size_t   size;
+	size_t   head;
+	size_t   tail;
+	int      put_waits;
+	int      get_waits;
+	sem_t    room;
+	sem_t    data;
+} ring_t;
+
+int   ring_init(struct ring *r, size_t size);
+void  ring_destroy(struct ring *r);
+void  ring_put(struct ring *r, void *item);
+void *ring_get(struct ring *r);
+void *ring_try(struct ring *r);
+
+#endif /* _NACL_CRYPT_RING_H */
@@ -0,0 +1,1284 @@
+#include "stream.h"
+#include "io.h"
+#include "lz.h"
+#include "ring.h"
+#include "uring.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <crypto_onetimeauth.h>
+#include <crypto_secretbox.h>
+#include <crypto_stream.h>
+#include <randombytes.h>
+
+#define SLOTS_PER_JOB (2)
+#define SPARE_SLOTS   (2)
+
+// a block is only packed if that saves at least a sixteenth of it
+#define PACK_GAIN     (16)
+
+enum slot_state {
+	SLOT_DONE = 0,
+	SLOT_SKIPPED,
+	SLOT_SHORT,
+	SLOT_FAILED,
+	SLOT_WRITE_FAILED
+};
+
+struct slot {
+	enum slot_state  state;
+	uint64_t         i;
+	size_t           len;
+	uint64_t         end;
+	uint64_t         off;
+	bool             last;
+	bool             final;
+	bool             packed;
+	bool             busy;
+	size_t           plain;
+	uint8_t         *m;
+	uint8_t         *c;
+	uint8_t         *z;
+};
+
+// the reader deals block i to worker i % jobs. the writer collects them in the same order.
+// every hop is a single producer single consumer ring and the writer returns slots on free.
+// a slot the reader took but can't use waits in spare for the next block.
+struct engine {
+	pthread_mutex_t  lock;
+	uint64_t         cancel_at;
+	struct ring      free;
+	struct slot     *spare;
+	struct ring     *in;
+	struct ring     *out;
+	struct slot     *slots;
+	struct slot    **retired;
+	size_t           n_retired;
+	uint8_t         *buf;
+	size_t           n;
+	size_t           bs;
+	unsigned         jobs;
+	bool             open;
+	bool             verify;
+	const uint8_t   *k;
+	struct input    *rd;
+	struct output   *wr;
+	const void      *head;
+	size_t           head_len;
+	enum sc          read_sc;
+	unsigned         depth;
+	bool             rd_queued;
+	bool             wr_queued;
+	struct uring     ur;
+	struct uring     uw;
+	struct slot    **queue;
+	unsigned         w_busy;
+	uint64_t         wpos;
+	uint64_t         first;
+	uint64_t         want;
+	uint64_t         stop;
+	uint64_t         from;
+	uint64_t         to;
+	bool             footer;
+	size_t           tail;
+	uint8_t          pend[FOOTER_LENGTH];
+	size_t           pend_len;
+	uint64_t         length;
+	const uint8_t   *carry;
+	size_t           carry_len;
+	bool             framed;
+	unsigned         latency;
+	size_t           flush;
+	bool             pack;
+	bool             salted;
+	size_t           over;
+	int            (*save)(void *arg, uint64_t blocks, uint64_t length);
+	void            *save_arg;
+	uint64_t         save_every;
+	bool             scatter;
+	uint64_t         base;
+	size_t           stride;
+	uint64_t         reserved;
+};
+
+struct job {
+	struct engine   *e;
+	unsigned         id;
+};
+
+static void    setup_open(struct engine *e, struct input *in, struct output *out, const struct stream *st);
+static enum sc run(struct engine *e, uint64_t *bad);
+static int     init_engine(struct engine *e);
+static size_t  slot_size(struct engine *e);
+static int     setup_scatter(struct engine *e);
+static void    free_engine(struct engine *e);
+static void    setup_queues(struct engine *e);
+static uint64_t data_left(struct engine *e);
+static void   *reader(void *arg);
+static void    read_stream(struct engine *e);
+static bool    read_block(struct engine *e, struct slot *s, size_t bl);
+static bool    fill_block(struct engine *e, struct slot *s);
+static bool    read_frame(struct engine *e, struct slot *s, bool skip);
+static void    read_queued(struct engine *e);
+static struct slot *take_slot(struct engine *e, bool wait);
+static void    read_footer(struct engine *e);
+static void    check_footer(struct engine *e, const uint8_t *f, size_t len, uint64_t blocks, uint64_t length);
+static int     write_footer(struct engine *e, uint64_t blocks);
+static void   *worker(void *arg);
+static void    pack_block(struct slot *s);
+static int     unpack_block(struct engine *e, struct slot *s);
+static enum sc writer(struct engine *e, uint64_t *bad);
+static uint8_t *block_in(struct engine *e, struct slot *s);
+static uint8_t *block_out(struct engine *e, struct slot *s);
+static size_t  block_out_len(struct engine *e, struct slot *s);
+static uint64_t block_out_off(struct engine *e, struct slot *s);
+static int     write_block(struct engine *e, struct slot *s);
+static int     reap_writes(struct engine *e, unsigned min);
+static int     flush_writes(struct engine *e);
+static void    retire(struct engine *e, struct slot *s, bool flush);
+static int     save_progress(struct engine *e, uint64_t blocks);
+static int     verify_block(struct engine *e, struct slot *s, const uint8_t *n);
+static int     open_box(uint8_t *restrict m, uint8_t *restrict c, size_t len, const uint8_t *restrict n, const uint8_t *restrict k);
+static void    cancel(struct engine *e, uint64_t i);
+static bool    cancelled(struct engine *e, uint64_t i);
+
+static void     put_be(uint8_t *p, uint64_t v, unsigned n);
+static uint64_t get_be(const uint8_t *p, unsigned n);
+
+void blk_nonce(uint8_t *restrict n, uint64_t i, const uint8_t *restrict k) {
+	put_be(n, i, 8);
+	memcpy(n + 8, k, crypto_secretbox_NONCEBYTES - 8);
+}
+
+int open_block(uint8_t *restrict m, const uint8_t *restrict c, size_t len, uint64_t i, const uint8_t *restrict k) {
+	uint8_t *pm = malloc(crypto_secretbox_ZEROBYTES + len);
+	uint8_t *pc = malloc(crypto_secretbox_BOXZEROBYTES + len);
+	int      rc = -1;
+
+	if ( pm && pc ) {
+		memcpy(pc + crypto_secretbox_BOXZEROBYTES, c, len);
+		if ( open_block_box(pm, pc, len, i, k) == 0 ) {
+			memcpy(m, pm + crypto_secretbox_ZEROBYTES, len - MAC_LENGTH);
+			rc = 0;
+		}
+	}
+
+	free(pc);
+	free(pm);
+	return rc;
+}
+
+int seal_block(uint8_t *restrict c, const uint8_t *restrict m, size_t len, uint64_t i, const uint8_t *restrict k) {
+	uint8_t *pm = malloc(crypto_secretbox_ZEROBYTES + len);
+	uint8_t *pc = malloc(crypto_secretbox_ZEROBYTES + len);
+	int      rc = -1;
+
+	if ( pm && pc ) {
+		memcpy(pm + crypto_secretbox_ZEROBYTES, m, len);
+		if ( seal_block_box(pc, pm, len, i, k) == 0 ) {
+			memcpy(c, pc + crypto_secretbox_BOXZEROBYTES, MAC_LENGTH + len);
+			rc = 0;
+		}
+	}
+
+	free(pc);
+	free(pm);
+	return rc;
+}
+
+int seal_salted(uint8_t *restrict c, const uint8_t *restrict m, size_t len, uint64_t i, const uint8_t *restrict k) {
+	uint8_t *pm = malloc(crypto_secretbox_ZEROBYTES + len);
+	uint8_t *pc = malloc(crypto_secretbox_ZEROBYTES + len);
+	int      rc = -1;
+
+	if ( pm && pc ) {
+		memcpy(pm + crypto_secretbox_ZEROBYTES, m, len);
+		if ( seal_salted_box(pc, pm, len, i, k) == 0 ) {
+			memcpy(c, pc, SALT_LENGTH + MAC_LENGTH + len);
+			rc = 0;
+		}
+	}
+
+	free(pc);
+	free(pm);
+	return rc;
+}
+
+int open_salted(uint8_t *restrict m, const uint8_t *restrict c, size_t len, uint64_t i, const uint8_t *restrict k) {
+	uint8_t *pm = malloc(crypto_secretbox_ZEROBYTES + len);
+	uint8_t *pc = malloc(len);
+	int      rc = -1;
+
+	if ( pm && pc ) {
+		memcpy(pc, c, len);
+		if ( open_salted_box(pm, pc, len, i, k) == 0 ) {
+			memcpy(m, pm + crypto_secretbox_ZEROBYTES, len - SALT_LENGTH - MAC_LENGTH);
+			rc = 0;
+		}
+	}
+
+	free(pc);
+	free(pm);
+	return rc;
+}
+
+int seal_block_box(uint8_t *restrict c, uint8_t *restrict m, size_t len, uint64_t i, const uint8_t *restrict k) {
+	uint8_t n[crypto_secretbox_NONCEBYTES];
+
+	memset(m, 0, crypto_secretbox_ZEROBYTES);
+	blk_nonce(n, i, k);
+	return crypto_secretbox(c, m, crypto_secretbox_ZEROBYTES + len, n, k) ? -1 : 0;
+}
+
+int open_block_box(uint8_t *restrict m, uint8_t *restrict c, size_t len, uint64_t i, const uint8_t *restrict k) {
+	uint8_t n[crypto_secretbox_NONCEBYTES];
+
+	blk_nonce(n, i, k);
+	return open_box(m, c, len, n, k);
+}
+
+// the salt goes where the box left its padding in front of the MAC
+int seal_salted_box(uint8_t *restrict c, uint8_t *restrict m, size_t len, uint64_t i, const uint8_t *restrict k) {
+	uint8_t n[crypto_secretbox_NONCEBYTES];
+	uint8_t salt[SALT_LENGTH];
+
+	memset(m, 0, crypto_secretbox_ZEROBYTES);
+	randombytes(salt, SALT_LENGTH);
+	blk_nonce(n, i, salt);
+	if ( crypto_secretbox(c, m, crypto_secretbox_ZEROBYTES + len, n, k) )
+		return -1;
+
+	memcpy(c, salt, SALT_LENGTH);
+	return 0;
+}
+
+int open_salted_box(uint8_t *restrict m, uint8_t *restrict c, size_t len, uint64_t i, const uint8_t *restrict k) {
+	uint8_t n[crypto_secretbox_NONCEBYTES];
+
+	if ( len < SALT_LENGTH )
+		return -1;
+
+	blk_nonce(n, i, c);
+	return open_box(m, c, len - SALT_LENGTH, n, k);
+}
+
+int seal_footer(uint8_t *restrict f, const uint8_t *restrict k, uint64_t length, uint64_t blocks, size_t bs) {
+	uint8_t m[crypto_secretbox_ZEROBYTES + FOOTER_LENGTH - MAC_LENGTH];
+	uint8_t c[crypto_secretbox_ZEROBYTES + FOOTER_LENGTH - MAC_LENGTH];
+	uint8_t n[crypto_secretbox_NONCEBYTES];
+
+	memset(m, 0, sizeof(m));
+	put_be(m + crypto_secretbox_ZEROBYTES +  0, length, 8);
+	put_be(m + crypto_secretbox_ZEROBYTES +  8, blocks, 8);
+	put_be(m + crypto_secretbox_ZEROBYTES + 16, bs, 4);
+
+	blk_nonce(n, UINT64_MAX, k);
+	if ( crypto_secretbox(c, m, sizeof(m), n, k) )
+		return -1;
+	memcpy(f, c + crypto_secretbox_BOXZEROBYTES, FOOTER_LENGTH);
+
+	return 0;
+}
+
+int open_footer(const uint8_t *restrict f, const uint8_t *restrict k, uint64_t *length, uint64_t *blocks, size_t *bs) {
+	uint8_t m[crypto_secretbox_ZEROBYTES + FOOTER_LENGTH - MAC_LENGTH];
+	uint8_t c[crypto_secretbox_ZEROBYTES + FOOTER_LENGTH - MAC_LENGTH];
+	uint8_t n[crypto_secretbox_NONCEBYTES];
+
+	memset(c, 0, crypto_secretbox_BOXZEROBYTES);
+	memcpy(c + crypto_secretbox_BOXZEROBYTES, f, FOOTER_LENGTH);
+
+	blk_nonce(n, UINT64_MAX, k);
+	if ( crypto_secretbox_open(m, c, sizeof(c), n, k) || get_be(m + crypto_secretbox_ZEROBYTES + 20, 4) )
+		return -1;
+
+	*length = get_be(m + crypto_secretbox_ZEROBYTES +  0, 8);
+	*blocks = get_be(m + crypto_secretbox_ZEROBYTES +  8, 8);
+	*bs     = get_be(m + crypto_secretbox_ZEROBYTES + 16, 4);
+	return 0;
+}
+
+enum sc seal_blocks(struct input *in, struct output *out, const struct stream *st) {
+	struct engine e;
+
+	memset(&e, 0, sizeof(e));
+	e.jobs     = st->jobs;
+	e.depth    = st->depth;
+	e.bs       = st->bs;
+	e.open     = false;
+	e.k        = st->k;
+	e.rd       = in;
+	e.wr       = out;
+	e.head     = st->head;
+	e.head_len = st->head_len;
+	e.footer   = st->footer;
+	e.first    = st->first;
+	e.length   = st->first * st->bs;
+	e.carry    = st->carry;
+	e.carry_len = st->carry_len;
+	e.framed   = st->framed;
+	e.latency  = st->latency;
+	e.flush    = st->flush;
+	e.pack     = st->pack;
+	e.salted   = st->salted;
+	e.over     = MAC_LENGTH + (st->salted ? SALT_LENGTH : 0);
+	e.save     = st->save;
+	e.save_arg = st->save_arg;
+	e.save_every = SAVE_BYTES / st->bs;
+	e.to       = UINT64_MAX;
+	e.stop     = UINT64_MAX;
+
+	return run(&e, NULL);
+}
+
+enum sc open_blocks(struct input *in, struct output *out, const struct stream *st, uint64_t *bad) {
+	struct engine e;
+
+	setup_open(&e, in, out, st);
+	return run(&e, bad);
+}
+
+enum sc verify_blocks(struct input *in, const struct stream *st, uint64_t *bad) {
+	struct engine e;
+	struct output none;
+
+	// nothing is written, but the engine looks at its output
+	memset(&none, 0, sizeof(none));
+	none.name  = "nowhere";
+	none.fd    = -1;
+	none.pipe  = -1;
+	none.drain = -1;
+
+	setup_open(&e, in, &none, st);
+	e.verify = true;
+	return run(&e, bad);
+}
+
+static void setup_open(struct engine *e, struct input *in, struct output *out, const struct stream *st) {
+	memset(e, 0, sizeof(*e));
+	e->jobs   = st->jobs;
+	e->depth  = st->depth;
+	e->bs     = st->bs;
+	e->open   = true;
+	e->k      = st->k;
+	e->rd     = in;
+	e->wr     = out;
+	e->first  = st->first;
+	e->from   = st->from;
+	e->to     = st->to;
+	e->want   = st->from / st->bs;
+	e->stop   = st->to == UINT64_MAX ? UINT64_MAX : (st->to - 1) / st->bs;
+	e->tail   = st->footer ? FOOTER_LENGTH : 0;
+	e->length = st->first * st->bs;
+	e->framed = st->framed;
+	e->pack   = st->pack;
+	e->salted = st->salted;
+	e->over   = MAC_LENGTH + (st->salted ? SALT_LENGTH : 0);
+}
+
+static enum sc run(struct engine *e, uint64_t *bad) {
+	unsigned      jobs = e->jobs;
+	struct job    job[jobs];
+	pthread_t     workers[jobs];
+	pthread_t     rd;
+	unsigned      started = 0;
+	enum sc       sc;
+
+	e->n         = SLOTS_PER_JOB * jobs + SPARE_SLOTS + 2 * e->depth;
+	if ( e->wr->hold )
+		e->n += e->wr->hold / (e->bs + MAC_LENGTH) + 2;
+	e->cancel_at = UINT64_MAX;
+	e->read_sc   = STREAM_OK;
+
+	if ( setup_scatter(e) )
+		return STREAM_WRITE_FAILED;
+
+	if ( init_engine(e) )
+		return STREAM_NO_MEMORY;
+
+	for ( ; started < jobs; started++ ) {
+		job[started].e  = e;
+		job[started].id = started;
+		if ( pthread_create(&workers[started], NULL, worker, &job[started]) )
+			break;
+	}
+
+	if ( started < jobs || pthread_create(&rd, NULL, reader, e) ) {
+		for ( unsigned t = 0; t < started; t++ )
+			ring_put(&e->in[t], NULL);
+		for ( unsigned t = 0; t < started; t++ )
+			pthread_join(workers[t], NULL);
+		free_engine(e);
+		return STREAM_THREAD_FAILED;
+	}
+
+	sc = writer(e, bad);
+
+	// blocks behind a failure may have been written already
+	if ( e->scatter && e->wr->off + e->wr->written < e->reserved && truncate_output(e->wr) && sc == STREAM_OK )
+		sc = STREAM_WRITE_FAILED;
+
+	pthread_join(rd, NULL);
+	for ( unsigned t = 0; t < jobs; t++ )
+		pthread_join(workers[t], NULL);
+	free_engine(e);
+
+	return sc;
+}
+
+static int init_engine(struct engine *e) {
+	unsigned rings = 0;
+
+	if ( pthread_mutex_init(&e->lock, NULL) )
+		return -1;
+
+	e->slots   = calloc(e->n, sizeof(struct slot));
+	e->retired = calloc(e->n, sizeof(struct slot *));
+	e->in      = calloc(e->jobs, sizeof(struct ring));
+	e->out     = calloc(e->jobs, sizeof(struct ring));
+	// the zero padding in front of m, c and z is never overwritten. clear it once.
+	// this is large enough to be mapped on its own, so pages still held by a pipe
+	// after the engine is gone are never handed out again.
+	e->buf     = calloc(e->n, slot_size(e));
+	if ( !e->slots || !e->retired || !e->in || !e->out || !e->buf )
+		goto fail;
+
+	if ( ring_init(&e->free, e->n) )
+		goto fail;
+
+	// one entry more than there are slots leaves room for the end marker
+	for ( ; rings < e->jobs; rings++ ) {
+		if ( ring_init(&e->in[rings], e->n + 1) )
+			goto rings;
+		if ( ring_init(&e->out[rings], e->n + 1) ) {
+			ring_destroy(&e->in[rings]);
+			goto rings;
+		}
+	}
+
+	for ( size_t s = 0; s < e->n; s++ ) {
+		e->slots[s].m = e->buf + s * slot_size(e);
+		e->slots[s].c = e->slots[s].m + crypto_secretbox_ZEROBYTES + e->bs;
+		e->slots[s].z = e->pack ? e->slots[s].c + crypto_secretbox_ZEROBYTES + e->bs : NULL;
+		ring_put(&e->free, &e->slots[s]);
+	}
+
+	setup_queues(e);
+	return 0;
+
+rings:
+	while ( rings-- ) {
+		ring_destroy(&e->out[rings]);
+		ring_destroy(&e->in[rings]);
+	}
+	ring_destroy(&e->free);
+fail:
+	free(e->buf);
+	free(e->out);
+	free(e->in);
+	free(e->retired);
+	free(e->slots);
+	pthread_mutex_destroy(&e->lock);
+	return -1;
+}
+
+// a packed block needs a third buffer next to plaintext and ciphertext
+static size_t slot_size(struct engine *e) {
+	return (e->pack ? 3 : 2) * (crypto_secretbox_ZEROBYTES + e->bs);
+}
+
+static void free_engine(struct engine *e) {
+	if ( e->rd_queued ) {
+		uring_free(&e->ur);
+		free(e->queue);
+	}
+	if ( e->wr_queued )
+		uring_free(&e->uw);
+
+	for ( unsigned t = 0; t < e->jobs; t++ ) {
+		ring_destroy(&e->out[t]);
+		ring_destroy(&e->in[t]);
+	}
+	ring_destroy(&e->free);
+	free(e->buf);
+	free(e->out);
+	free(e->in);
+	free(e->retired);
+	free(e->slots);
+	pthread_mutex_destroy(&e->lock);
+}
+
+// io_uring is optional. whatever can't get a queue goes through read(2) and write(2).
+// regular files are addressed by offset, so several blocks can be in flight at once.
+static void setup_queues(struct engine *e) {
+	size_t len = e->n * slot_size(e);
+
+	if ( !e->depth )
+		return;
+
+	// a carry shifts the input against the blocks
+	if ( e->rd->regular && !e->rd->mapped && !e->carry && !e->framed && (e->queue = calloc(e->depth, sizeof(struct slot *))) ) {
+		if ( uring_init(&e->ur, e->depth) == 0 ) {
+			uring_register(&e->ur, e->buf, len);
+			e->rd_queued = true;
+		} else {
+			free(e->queue);
+		}
+	}
+
+	if ( e->wr->regular && !e->wr->splice && !e->scatter && uring_init(&e->uw, e->depth) == 0 ) {
+		uring_register(&e->uw, e->buf, len);
+		e->wr_queued = true;
+		e->wr->seek  = true;
+		e->wpos      = e->wr->off;
+	}
+}
+
+// from a regular file to a regular file the offset of every block is known up front.
+// reserve the whole output and let the workers write their blocks where they belong.
+static int setup_scatter(struct engine *e) {
+	uint64_t total = data_left(e);
+	size_t   bl    = e->bs + (e->open ? e->over : 0);
+	uint64_t n     = total / bl + 1;
+	uint64_t len;
+
+	if ( !e->rd->regular || !e->wr->regular || e->wr->splice || e->carry || e->framed )
+		return 0;
+
+	// a truncated last block is reported by the workers. there is nothing to reserve for it.
+	if ( e->open && total % bl < e->over )
+		return 0;
+
+	if ( e->open ) {
+		uint64_t end = e->first * e->bs + total - n * e->over;
+		uint64_t to  = end < e->to ? end : e->to;
+
+		len       = to > e->from ? to - e->from : 0;
+		e->base   = e->wr->off;
+		e->stride = e->bs;
+	} else {
+		len       = e->head_len + total + n * e->over + (e->footer ? FOOTER_LENGTH : 0);
+		e->base   = e->wr->off + e->head_len;
+		e->stride = e->bs + e->over;
+	}
+
+	if ( reserve_output(e->wr, len) )
+		return -1;
+
+	if ( e->head_len ) {
+		if ( write_output_at(e->wr, e->head, e->head_len, e->wr->off) )
+			return -1;
+		e->wr->written += e->head_len;
+	}
+
+	e->scatter  = true;
+	e->reserved = e->wr->off + len;
+	e->wr->seek = true;
+	return 0;
+}
+
+// block data left in a regular input, without the footer
+static uint64_t data_left(struct engine *e) {
+	uint64_t left = e->rd->size > e->rd->off ? e->rd->size - e->rd->off : 0;
+
+	return left > e->tail ? left - e->tail : 0;
+}
+
+static void *reader(void *arg) {
+	struct engine *e = arg;
+
+	if ( e->tail && e->rd->regular )
+		read_footer(e);
+
+	if ( e->read_sc == STREAM_OK ) {
+		if ( e->rd_queued )
+			read_queued(e);
+		else
+			read_stream(e);
+	}
+
+	for ( unsigned t = 0; t < e->jobs; t++ )
+		ring_put(&e->in[t], NULL);
+
+	return NULL;
+}
+
+static void read_stream(struct engine *e) {
+	size_t   bl  = e->bs + (e->open ? e->over : 0);
+	uint64_t seq = 0;
+
+	for ( uint64_t i = e->first; !cancelled(e, i); i++ ) {
+		if ( i == UINT64_MAX || (e->framed && i >= BLOCK_PACKED) ) {
+			e->read_sc = STREAM_OVERFLOW;
+			break;
+		}
+
+		struct slot *s   = take_slot(e, true);
+		bool         end = !e->framed ? read_block(e, s, bl) : e->open ? read_frame(e, s, i < e->want) : fill_block(e, s);
+		if ( e->rd->failed ) {
+			e->read_sc = STREAM_READ_FAILED;
+			break;
+		}
+		if ( e->read_sc != STREAM_OK ) {
+			e->spare = s;
+			break;
+		}
+
+		s->i    = i;
+		s->last = end || i == e->stop;
+
+		// the writer looks at the footer with the last block. it has to be known before.
+		if ( e->open && s->len >= MAC_LENGTH )
+			e->length += s->len - MAC_LENGTH;
+		if ( end && e->tail && !e->rd->regular )
+			check_footer(e, e->pend, e->pend_len, i + 1, e->length);
+
+		// a pipe can't seek to the range. skip what comes before it, but open the last block.
+		if ( i < e->want && !s->last ) {
+			e->spare = s;
+			continue;
+		}
+		ring_put(&e->in[seq++ % e->jobs], s);
+
+		if ( s->last )
+			break;
+	}
+}
+
+// fill the next block and tell if the input ended with it. with a footer the bytes behind
+// the block are read ahead, so the footer never ends up inside the last block.
+static bool read_block(struct engine *e, struct slot *s, size_t bl) {
+	uint8_t *b = block_in(e, s);
+	size_t   j;
+
+	if ( !e->tail ) {
+		j = 0;
+		if ( e->carry ) {
+			memcpy(b, e->carry, e->carry_len);
+			j        = e->carry_len;
+			e->carry = NULL;
+		}
+		s->len = j + read_input(e->rd, b + j, bl - j);
+		return s->len < bl;
+	}
+
+	memcpy(b, e->pend, e->pend_len);
+	j = e->pend_len + read_input(e->rd, b + e->pend_len, bl - e->pend_len);
+
+	if ( j < bl ) {
+		// too short to even hold the footer. check_footer reports it.
+		if ( j < e->tail ) {
+			s->len      = j;
+			e->pend_len = 0;
+			return true;
+		}
+		memcpy(e->pend, b + j - e->tail, e->tail);
+		e->pend_len = e->tail;
+		s->len      = j - e->tail;
+		return true;
+	}
+
+	e->pend_len = read_input(e->rd, e->pend, e->tail);
+	if ( e->pend_len == e->tail ) {
+		s->len = bl;
+		return false;
+	}
+
+	// the footer starts inside this block
+	size_t inside = e->tail - e->pend_len;
+	memmove(e->pend + inside, e->pend, e->pend_len);
+	memcpy(e->pend, b + bl - inside, inside);
+	e->pend_len = e->tail;
+	s->len      = bl - inside;
+	return true;
+}
+
+// a pipe is sealed as soon as the deadline passed or enough arrived. waiting for a full
+// block could hold back a slow source for minutes. files are read in full blocks.
+static bool fill_block(struct engine *e, struct slot *s) {
+	uint8_t         *b       = block_in(e, s);
+	size_t           j       = 0;
+	int              timeout = -1;
+	struct timespec  t0;
+	struct timespec  t;
+
+	// a carry is data that arrived already, the deadline runs from here
+	s->packed = false;
+	if ( e->carry ) {
+		memcpy(b, e->carry, e->carry_len);
+		j        = e->carry_len;
+		e->carry = NULL;
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+	}
+
+	if ( e->rd->regular ) {
+		s->len   = j + read_input(e->rd, b + j, e->bs - j);
+		s->final = s->len < e->bs;
+		return s->final;
+	}
+
+	while ( j < e->bs && !input_eof(e->rd) && !e->rd->failed ) {
+		if ( j && e->latency ) {
+			clock_gettime(CLOCK_MONOTONIC, &t);
+			long ms = (t.tv_sec - t0.tv_sec) * 1000 + (t.tv_nsec - t0.tv_nsec) / 1000000;
+			if ( ms >= e->latency )
+				break;
+			timeout = e->latency - ms;
+		}
+
+		size_t r = poll_input(e->rd, b + j, e->bs - j, timeout);
+		if ( r && !j )
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+		j += r;
+
+		if ( e->flush && j >= e->flush )
+			break;
+	}
+
+	s->len   = j;
+	s->final = input_eof(e->rd);
+	return s->final;
+}
+
+// the frame header tells the length of the block and if it is the final one. a stream
+// that ends without the final block was cut off. blocks in front of a range are read
+// past in a file, only their headers are needed to find the next one.
+static bool read_frame(struct engine *e, struct slot *s, bool skip) {
+	uint8_t  h[FRAME_LENGTH];
+	uint32_t len;
+
+	if ( read_input(e->rd, h, FRAME_LENGTH) != FRAME_LENGTH ) {
+		e->read_sc = STREAM_TRUNCATED;
+		return true;
+	}
+
+	len       = get_be(h, FRAME_LENGTH);
+	s->final  = len & FRAME_FINAL;
+	s->packed = len & FRAME_PACKED;
+	len      &= ~(FRAME_FINAL | FRAME_PACKED);
+
+	// no block is that long. the worker reports it as too short.
+	if ( len > e->bs + MAC_LENGTH ) {
+		s->len = 0;
+		return true;
+	}
+
+	if ( skip && !s->final && e->rd->regular ) {
+		uint64_t off = e->rd->off;
+
+		if ( skip_input(e->rd, len) )
+			e->rd->failed = true;
+		s->len = e->rd->off - off;
+		return s->len < len;
+	}
+
+	s->len = read_input(e->rd, block_in(e, s), len);
+	return s->final || s->len < len;
+}
+
+// the block layout of a regular file is known up front. keep up to depth reads in flight
+// and deal the blocks in order as they complete.
+static void read_queued(struct engine *e) {
+	size_t   bl    = e->bs + (e->open ? e->over : 0);
+	uint64_t base  = e->rd->off;
+	uint64_t total = data_left(e);
+	uint64_t last  = total / bl;
+	uint64_t i     = 0;
+
+	if ( e->stop - e->first < last )
+		last = e->stop - e->first;
+	uint64_t done  = 0;
+	unsigned busy  = 0;
+	uint64_t tag;
+	int32_t  res;
+
+	while ( done <= last && e->read_sc == STREAM_OK ) {
+		while ( i <= last && i - done < e->depth && !cancelled(e, e->first + i) ) {
+			// only block for a slot if none is held back here. the writer may be waiting for it.
+			struct slot *s = take_slot(e, i == done);
+			if ( !s )
+				break;
+
+			s->i    = e->first + i;
+			s->len  = total - i * bl < bl ? total - i * bl : bl;
+			s->last = i == last;
+			s->busy = s->len != 0;
+			if ( s->busy ) {
+				if ( uring_read(&e->ur, e->rd->fd, block_in(e, s), s->len, base + i * bl, (uintptr_t) s) ) {
+					e->spare = s;
+					break;
+				}
+				busy++;
+			}
+			e->queue[i++ % e->depth] = s;
+		}
+
+		if ( done == i )
+			break;
+
+		if ( uring_wait(&e->ur, e->queue[done % e->depth]->busy) ) {
+			e->read_sc = STREAM_READ_FAILED;
+			break;
+		}
+
+		while ( uring_reap(&e->ur, &tag, &res) ) {
+			struct slot *s   = (struct slot *) (uintptr_t) tag;
+			size_t       got = res > 0 ? res : 0;
+
+			// a file that shrank since it was opened can't fill the blocks
+			if ( res < 0 || (got < s->len && read_input_at(e->rd, block_in(e, s) + got, s->len - got, base + (s->i - e->first) * bl + got) != s->len - got) )
+				e->read_sc = STREAM_READ_FAILED;
+			s->busy = false;
+			busy--;
+		}
+
+		while ( done < i && !e->queue[done % e->depth]->busy && e->read_sc == STREAM_OK ) {
+			ring_put(&e->in[done % e->jobs], e->queue[done % e->depth]);
+			done++;
+		}
+	}
+
+	// the kernel may still fill buffers. the engine must not go away before it is done.
+	while ( busy && !uring_wait(&e->ur, 1) ) {
+		while ( uring_reap(&e->ur, &tag, &res) )
+			busy--;
+	}
+}
+
+// the writer is the only one to put slots on free. the reader keeps back what it can't use.
+static struct slot *take_slot(struct engine *e, bool wait) {
+	struct slot *s = e->spare;
+
+	if ( s ) {
+		e->spare = NULL;
+		return s;
+	}
+
+	return wait ? ring_get(&e->free) : ring_try(&e->free);
+}
+
+// a regular file has its footer at the end. check it before the first block is read.
+static void read_footer(struct engine *e) {
+	uint8_t  f[FOOTER_LENGTH];
+	size_t   bl    = e->bs + MAC_LENGTH;
+	uint64_t total = data_left(e);
+	uint64_t n     = total / bl + 1;
+	uint64_t len   = e->first * e->bs;
+
+	if ( e->rd->size < e->rd->off + e->tail ) {
+		e->read_sc = STREAM_BAD_FOOTER;
+		return;
+	}
+
+	if ( read_input_at(e->rd, f, e->tail, e->rd->off + total) != e->tail ) {
+		e->read_sc = STREAM_READ_FAILED;
+		return;
+	}
+
+	// a last block shorter than a MAC fails on its own
+	if ( total % bl >= MAC_LENGTH )
+		len += total - n * MAC_LENGTH;
+	check_footer(e, f, e->tail, e->first + n, len);
+}
+
+static void check_footer(struct engine *e, const uint8_t *f, size_t len, uint64_t blocks, uint64_t length) {
+	uint64_t l;
+	uint64_t n;
+	size_t   bs;
+
+	if ( len != FOOTER_LENGTH || open_footer(f, e->k, &l, &n, &bs) || l != length || n != blocks || bs != e->bs )
+		e->read_sc = STREAM_BAD_FOOTER;
+}
+
+static void *worker(void *arg) {
+	struct job    *job = arg;
+	struct engine *e   = job->e;
+	struct slot   *s;
+	uint8_t        n[crypto_secretbox_NONCEBYTES];
+	uint8_t        salt[SALT_LENGTH];
+
+	while ( (s = ring_get(&e->in[job->id])) ) {
+		s->state = SLOT_DONE;
+
+		// blocks behind a broken one are never written. don't waste time on them.
+		if ( cancelled(e, s->i) ) {
+			s->state = SLOT_SKIPPED;
+			ring_put(&e->out[job->id], s);
+			continue;
+		}
+
+		if ( e->pack && !e->open )
+			pack_block(s);
+
+		// a salt is read into the padding in front of the MAC. the box wants it zero again.
+		if ( e->salted && e->open ) {
+			memcpy(salt, s->c, SALT_LENGTH);
+			memset(s->c, 0, SALT_LENGTH);
+			s->len = s->len >= SALT_LENGTH ? s->len - SALT_LENGTH : 0;
+		} else if ( e->salted ) {
+			randombytes(salt, SALT_LENGTH);
+		}
+		blk_nonce(n, s->i | (e->framed && s->final ? BLOCK_FINAL : 0) | (s->packed ? BLOCK_PACKED : 0), e->salted ? salt : e->k);
+
+		if ( e->open ) {
+			if ( s->len < MAC_LENGTH )
+				s->state = SLOT_SHORT;
+			else if ( e->verify ? verify_block(e, s, n) : crypto_secretbox_open(s->m, s->c, crypto_secretbox_BOXZEROBYTES + s->len, n, e->k) || unpack_block(e, s) )
+				s->state = SLOT_FAILED;
+		} else if ( crypto_secretbox(s->c, s->packed ? s->z : s->m, crypto_secretbox_ZEROBYTES + s->len, n, e->k) ) {
+			s->state = SLOT_FAILED;
+		} else if ( e->framed ) {
+			// the frame header goes into the padding the box left in front of the MAC
+			put_be(s->c + crypto_secretbox_BOXZEROBYTES - FRAME_LENGTH, (s->final ? FRAME_FINAL : 0) | (s->packed ? FRAME_PACKED : 0) | (s->len + MAC_LENGTH), FRAME_LENGTH);
+		} else if ( e->salted ) {
+			memcpy(s->c, salt, SALT_LENGTH);
+		}
+
+		if ( s->state == SLOT_DONE && e->scatter && write_output_at(e->wr, block_out(e, s), block_out_len(e, s), block_out_off(e, s)) )
+			s->state = SLOT_WRITE_FAILED;
+
+		if ( s->state != SLOT_DONE && s->state != SLOT_SKIPPED )
+			cancel(e, s->i);
+
+		ring_put(&e->out[job->id], s);
+	}
+	ring_put(&e->out[job->id], NULL);
+
+	return NULL;
+}
+
+// the packed block is sealed from z instead of m. what doesn't shrink enough stays as it is.
+static void pack_block(struct slot *s) {
+	size_t len = lz_pack(s->z + crypto_secretbox_ZEROBYTES, s->len - s->len / PACK_GAIN, s->m + crypto_secretbox_ZEROBYTES, s->len);
+
+	if ( len ) {
+		s->len    = len;
+		s->packed = true;
+	}
+}
+
+// plaintext of a packed block ends up in z. in a packed stream every block but the
+// final one has to come out full, or the offsets of a range would be wrong.
+static int unpack_block(struct engine *e, struct slot *s) {
+	s->plain = s->len - MAC_LENGTH;
+	if ( s->packed && lz_unpack(s->z + crypto_secretbox_ZEROBYTES, e->bs, s->m + crypto_secretbox_ZEROBYTES, s->plain, &s->plain) )
+		return -1;
+
+	return e->pack && !s->final && s->plain != e->bs ? -1 : 0;
+}
+
+static enum sc writer(struct engine *e, uint64_t *bad) {
+	enum sc sc = STREAM_OK;
+
+	// after a failure keep draining until the reader gave up so no thread blocks forever
+	for ( uint64_t seq = 0; true; seq++ ) {
+		struct slot *s       = ring_get(&e->out[seq % e->jobs]);
+		bool         last    = false;
+		bool         written = false;
+
+		if ( !s ) {
+			if ( flush_writes(e) && sc == STREAM_OK )
+				sc = STREAM_WRITE_FAILED;
+			return sc == STREAM_OK ? e->read_sc : sc;
+		}
+
+		uint64_t i = s->i;
+
+		// a bad footer means the stream was cut or tampered with. the last block can't be trusted.
+		if ( sc == STREAM_OK && s->last && e->read_sc != STREAM_OK ) {
+			sc = e->read_sc;
+			ring_put(&e->free, s);
+			continue;
+		}
+
+		if ( sc == STREAM_OK ) {
+			switch ( s->state ) {
+				case SLOT_SHORT:
+					sc = STREAM_TOO_SHORT;
+					break;
+
+				case SLOT_FAILED:
+					sc = e->open ? STREAM_BAD_MAC : STREAM_CRYPTO_FAILED;
+					break;
+
+				case SLOT_WRITE_FAILED:
+					sc = STREAM_WRITE_FAILED;
+					break;
+
+				default:
+					if ( e->verify )
+						break;
+					if ( write_block(e, s) ) {
+						sc = STREAM_WRITE_FAILED;
+						cancel(e, i);
+					} else {
+						written = true;
+						if ( !e->open )
+							e->length += s->len;
+					}
+					break;
+			}
+
+			if ( sc != STREAM_OK && bad )
+				*bad = i;
+			last = sc == STREAM_OK && s->last;
+		}
+
+		// once nothing is written anymore no later block reuses an output buffer. let go.
+		// queued writes hand their slot back once they completed.
+		if ( !written )
+			ring_put(&e->free, s);
+		else if ( !s->busy )
+			retire(e, s, false);
+
+		if ( e->wr_queued && reap_writes(e, 0) && sc == STREAM_OK ) {
+			sc   = STREAM_WRITE_FAILED;
+			last = false;
+			cancel(e, i);
+		}
+		if ( written && e->save && !last && (i + 1) % e->save_every == 0 && sc == STREAM_OK && save_progress(e, i + 1) ) {
+			sc = STREAM_SAVE_FAILED;
+			cancel(e, i);
+			if ( bad )
+				*bad = i;
+		}
+		if ( sc != STREAM_OK ) {
+			flush_writes(e);
+			retire(e, NULL, true);
+		}
+
+		if ( last ) {
+			if ( flush_writes(e) )
+				return STREAM_WRITE_FAILED;
+			if ( !e->open && e->footer && write_footer(e, i + 1) )
+				return STREAM_WRITE_FAILED;
+			return sc;
+		}
+	}
+}
+
+static uint8_t *block_in(struct engine *e, struct slot *s) {
+	return e->open ? s->c + crypto_secretbox_BOXZEROBYTES - (e->salted ? SALT_LENGTH : 0) : s->m + crypto_secretbox_ZEROBYTES;
+}
+
+// plaintext is cut down to the requested range
+static uint8_t *block_out(struct engine *e, struct slot *s) {
+	if ( !e->open )
+		return s->c + crypto_secretbox_BOXZEROBYTES - (e->framed ? FRAME_LENGTH : 0) - (e->salted ? SALT_LENGTH : 0);
+
+	uint64_t start = s->i * e->bs;
+	uint8_t *m     = (s->packed ? s->z : s->m) + crypto_secretbox_ZEROBYTES;
+	if ( e->from <= start )
+		return m;
+	return m + (e->from - start < s->plain ? e->from - start : s->plain);
+}
+
+static size_t block_out_len(struct engine *e, struct slot *s) {
+	uint64_t lo = s->i * e->bs;
+	uint64_t hi = lo + s->plain;
+
+	if ( !e->open )
+		return s->len + crypto_secretbox_BOXZEROBYTES + (e->framed ? FRAME_LENGTH : 0) + (e->salted ? SALT_LENGTH : 0);
+
+	if ( lo < e->from )
+		lo = e->from;
+	if ( hi > e->to )
+		hi = e->to;
+	return hi > lo ? hi - lo : 0;
+}
+
+// sealed blocks are counted from the first one written, plaintext from the start of the range
+static uint64_t block_out_off(struct engine *e, struct slot *s) {
+	uint64_t start = (e->open ? s->i : s->i - e->first) * e->stride;
+
+	return e->base + (start > e->from ? start - e->from : 0);
+}
+
+static int write_block(struct engine *e, struct slot *s) {
+	struct iovec iov[2];
+	int          n = 0;
+
+	// the stream header goes out in the same call as the first block
+	if ( !e->open && s->i == 0 && e->head_len ) {
+		iov[n].iov_base = (void *) e->head;
+		iov[n].iov_len  = e->head_len;
+		n++;
+	}
+	iov[n].iov_base = block_out(e, s);
+	iov[n].iov_len  = block_out_len(e, s);
+	n++;
+
+	// the worker wrote it already. only count it in order.
+	if ( e->scatter ) {
+		e->wr->written += iov[n - 1].iov_len;
+		return 0;
+	}
+
+	if ( e->wr_queued ) {
+		// the header goes out first and on its own. it is written before any queued block.
+		if ( n == 2 ) {
+			if ( write_output(e->wr, iov, 1) )
+				return -1;
+			e->wpos += e->head_len;
+		}
+		if ( e->w_busy == e->depth && reap_writes(e, 1) )
+			return -1;
+
+		s->off  = e->wpos;
+		s->busy = true;
+		if ( uring_write(&e->uw, e->wr->fd, iov[n - 1].iov_base, iov[n - 1].iov_len, s->off, (uintptr_t) s) ) {
+			s->busy = false;
+			return -1;
+		}
+		e->wpos += iov[n - 1].iov_len;
+		e->w_busy++;
+		return uring_wait(&e->uw, 0);
+	}
+
+	if ( !e->wr->splice )
+		return write_output(e->wr, iov, n);
+
+	// the header lives on the callers stack. only block buffers are lent to the kernel.
+	if ( n == 2 && write_output(e->wr, iov, 1) )
+		return -1;
+	return splice_output(e->wr, &iov[n - 1], 1);
+}
+
+static int write_footer(struct engine *e, uint64_t blocks) {
+	uint8_t      f[FOOTER_LENGTH];
+	struct iovec iov = { .iov_base = f, .iov_len = sizeof(f) };
+
+	if ( seal_footer(f, e->k, e->length, blocks, e->bs) )
+		return -1;
+
+	// positioned outputs count written in order. the footer goes behind all of it.
+	if ( e->scatter || e->wr_queued ) {
+		if ( write_output_at(e->wr, f, sizeof(f), e->wr->off + e->wr->written) )
+			return -1;
+		e->wr->written += sizeof(f);
+		return 0;
+	}
+
+	return write_output(e->wr, &iov, 1);
+}
+
+// collect completed writes and return their slots. short writes are finished in place.
+static int reap_writes(struct engine *e, unsigned min) {
+	uint64_t tag;
+	int32_t  res;
+	int      rc = 0;
+
+	if ( uring_wait(&e->uw, min) )
+		return -1;
+
+	while ( uring_reap(&e->uw, &tag, &res) ) {
+		struct slot *s   = (struct slot *) (uintptr_t) tag;
+		size_t       len = block_out_len(e, s);
+
+		if ( res < 0 || ((size_t) res < len && write_output_at(e->wr, block_out(e, s) + res, len - res, s->off + res)) )
+			rc = -1;
+		else
+			e->wr->written += len;
+
+		s->busy = false;
+		e->w_busy--;
+		ring_put(&e->free, s);
+	}
+
+	return rc;
+}
+
+static int flush_writes(struct engine *e) {
+	int rc = 0;
+
+	while ( e->w_busy ) {
+		unsigned busy = e->w_busy;
+		if ( reap_writes(e, busy) )
+			rc = -1;
+		if ( e->w_busy == busy )
+			break;
+	}
+
+	return rc;
+}
+
+// keep spliced slots away from the reader until the pipe can no longer reference them
+static void retire(struct engine *e, struct slot *s, bool flush) {
+	if ( s ) {
+		if ( !e->wr->hold ) {
+			ring_put(&e->free, s);
+		} else {
+			s->end = e->wr->written;
+			e->retired[e->n_retired++] = s;
+		}
+	}
+
+	size_t r = 0;
+	while ( r < e->n_retired && (flush || e->wr->written - e->retired[r]->end >= e->wr->hold) )
+		ring_put(&e->free, e->retired[r++]);
+
+	memmove(e->retired, e->retired + r, (e->n_retired - r) * sizeof(struct slot *));
+	e->n_retired -= r;
+}
+
+// everything up to blocks has to be on disk before anything may say so
+static int save_progress(struct engine *e, uint64_t blocks) {
+	if ( flush_writes(e) || sync_output(e->wr) )
+		return -1;
+
+	return e->save(e->save_arg, blocks, e->wr->off + e->wr->written);
+}
+
+// the box wants zeroes where the MAC's padding or a salt was
+static int open_box(uint8_t *restrict m, uint8_t *restrict c, size_t len, const uint8_t *restrict n, const uint8_t *restrict k) {
+	if ( len < MAC_LENGTH )
+		return -1;
+
+	memset(c, 0, crypto_secretbox_BOXZEROBYTES);
+	return crypto_secretbox_open(m, c, crypto_secretbox_BOXZEROBYTES + len, n, k) ? -1 : 0;
+}
+
+// what crypto_secretbox_open() checks before it decrypts. the first 32 bytes of the
+// key stream are the one-time authenticator key, the rest is never generated.
+static int verify_block(struct engine *e, struct slot *s, const uint8_t *n) {
+	uint8_t a[crypto_onetimeauth_KEYBYTES];
+
+	if ( crypto_stream(a, sizeof(a), n, e->k) )
+		return -1;
+	return crypto_onetimeauth_verify(s->c + crypto_secretbox_BOXZEROBYTES, s->c + crypto_secretbox_ZEROBYTES, s->len - MAC_LENGTH, a);
+}
+
+static void cancel(struct engine *e, uint64_t i) {
+	pthread_mutex_lock(&e->lock);
+	if ( i < e->cancel_at )
+		e->cancel_at = i;
+	pthread_mutex_unlock(&e->lock);
+}
+
+static void put_be(uint8_t *p, uint64_t v, unsigned n) {
+	while ( n-- ) {
+		p[n]   = v;
+		v    >>= 8;
+	}
+}
+
+static uint64_t get_be(const uint8_t *p, unsigned n) {
+	uint64_t v = 0;
+
+	while ( n-- )
+		v = v << 8 | *p++;
+	return v;
+}
+
+static bool cancelled(struct engine *e, uint64_t i) {
+	bool c;
+
+	pthread_mutex_lock(&e->lock);
+	c = i > e->cancel_at;
+	pthread_mutex_unlock(&e->lock);
+
+	return c;
+}
@@ -0,0 +1,119 @@
+#ifndef _NACL_CRYPT_STREAM_H
+#define _NACL_CRYPT_STREAM_H
+
+#include "io.h"
+#include "types.h"
+
+// a framed stream has blocks of any length up to the block size. every block is
+// preceded by its sealed length, the top bit marks the final one.
+#define FRAME_LENGTH (4)
+#define FRAME_FINAL  (UINT32_C(1) << 31)
+#define FRAME_PACKED (UINT32_C(1) << 30)
+
+// the same bits go into the block counter of the nonce, so they can't be flipped
+#define BLOCK_FINAL  (UINT64_C(1) << 63)
+#define BLOCK_PACKED (UINT64_C(1) << 62)
+
+// block size of the original format and the default. versioned streams may use
+// any power of two from MIN_BS to MAX_BS.
+#define BS     (131072)
+#define MIN_BS (4096)
+#define MAX_BS (16 * 1024 * 1024)
+
+// sealed plaintext length, block count and block size behind the last block
+#define FOOTER_LENGTH (MAC_LENGTH + 24)
+
+// an updatable block starts with a random salt. it takes the place of the key bytes in
+// the nonce, so a block can be sealed again in place under a nonce never used before.
+#define SALT_LENGTH (16)
+
+#define SAVE_BYTES (256 * 1024 * 1024)
+
+typedef enum sc {
+	STREAM_OK = 0,
+	STREAM_READ_FAILED,
+	STREAM_WRITE_FAILED,
+	STREAM_CRYPTO_FAILED,
+	STREAM_TOO_SHORT,
+	STREAM_BAD_MAC,
+	STREAM_OVERFLOW,
+	STREAM_NO_MEMORY,
+	STREAM_THREAD_FAILED,
+	STREAM_BAD_FOOTER,
+	STREAM_TRUNCATED,
+	STREAM_SAVE_FAILED
+} sc_t;
+
+// what the engine works on. head is written in front of the first sealed block.
+// in is positioned at block first. open_blocks emits only plaintext from from to to,
+// blocks entirely in front of it are read past without opening them. seal_blocks
+// starts block first with carry, all blocks in front of it are full. framed streams
+// seal a block once latency ms passed since its first byte arrived or it holds flush
+// bytes, whatever comes first. zero disables either. packed streams are framed and pack
+// every block that shrinks by enough. their blocks can be found by the frame headers alone.
+// with save set seal_blocks syncs the output every SAVE_BYTES of input and passes the
+// number of blocks and bytes on disk to save. a failing save stops the stream. salted
+// streams have a salt in front of every block.
+typedef struct stream {
+	const uint8_t *k;
+	size_t         bs;
+	unsigned       jobs;
+	unsigned       depth;
+	const void    *head;
+	size_t         head_len;
+	uint64_t       first;
+	uint64_t       from;
+	uint64_t       to;
+	bool           footer;
+	const uint8_t *carry;
+	size_t         carry_len;
+	bool           framed;
+	unsigned       latency;
+	size_t         flush;
+	bool           pack;
+	bool           salted;
+	int          (*save)(void *arg, uint64_t blocks, uint64_t length);
+	void          *save_arg;
+} stream_t;
+
+// nonce of block i: big endian block counter followed by the first 16 key bytes.
+void    blk_nonce(uint8_t *restrict n, uint64_t i, const uint8_t *restrict k);
+
+// seal len bytes of m as block i into MAC_LENGTH + len bytes of c. open one sealed block
+// of len bytes into len - MAC_LENGTH bytes of m.
+int     seal_block(uint8_t *restrict c, const uint8_t *restrict m, size_t len, uint64_t i, const uint8_t *restrict k);
+int     open_block(uint8_t *restrict m, const uint8_t *restrict c, size_t len, uint64_t i, const uint8_t *restrict k);
+
+// an updatable block is salt, MAC and ciphertext. seal_salted seals len bytes of m under a
+// new salt, open_salted opens a whole block of len bytes.
+int     seal_salted(uint8_t *restrict c, const uint8_t *restrict m, size_t len, uint64_t i, const uint8_t *restrict k);
+int     open_salted(uint8_t *restrict m, const uint8_t *restrict c, size_t len, uint64_t i, const uint8_t *restrict k);
+
+// the same on the caller's buffers, laid out for crypto_secretbox(). nothing is allocated
+// or copied. m and c start with crypto_secretbox_ZEROBYTES of room in front of the data,
+// the plaintext is at m + crypto_secretbox_ZEROBYTES. a block is at
+// c + crypto_secretbox_BOXZEROBYTES, an updatable block at c, its salt in the room. the
+// room is written to on both ways.
+int     seal_block_box(uint8_t *restrict c, uint8_t *restrict m, size_t len, uint64_t i, const uint8_t *restrict k);
+int     open_block_box(uint8_t *restrict m, uint8_t *restrict c, size_t len, uint64_t i, const uint8_t *restrict k);
+int     seal_salted_box(uint8_t *restrict c, uint8_t *restrict m, size_t len, uint64_t i, const uint8_t *restrict k);
+int     open_salted_box(uint8_t *restrict m, uint8_t *restrict c, size_t len, uint64_t i, const uint8_t *restrict k);
+
+// the footer is sealed under the counter value no block can reach
+int     seal_footer(uint8_t *restrict f, const uint8_t *restrict k, uint64_t length, uint64_t blocks, size_t bs);
+int     open_footer(const uint8_t *restrict f, const uint8_t *restrict k, uint64_t *length, uint64_t *blocks, size_t *bs);
+
+// seal all blocks from in to out on jobs worker threads. output is identical to the serial loop.
+// a depth keeps that many reads and writes of regular files in flight through io_uring
+// where the kernel supports it.
+enum sc seal_blocks(struct input *in, struct output *out, const struct stream *st);
+
+// open all blocks from in to out on jobs worker threads. plaintext is written strictly in order.
+// the first broken block cancels all outstanding work and is returned in *bad.
+// a footer that is missing or doesn't match the blocks fails the last block.
+enum sc open_blocks(struct input *in, struct output *out, const struct stream *st, uint64_t *bad);
+
+// check the MAC of every block like open_blocks without decrypting or writing anything
+enum sc verify_blocks(struct input *in, const struct stream *st, uint64_t *bad);
+
+#endif /* _NACL_CRYPT_STREAM_H */
@@ -17,6 +17,11 @@ typedef struct sk {
 	uint8_t sk[crypto_box_SECRETKEYBYTES];
 } sk_t;
 
+// what every box between the same public and secret key starts from
+typedef struct bk {
+	uint8_t bk[crypto_box_BEFORENMBYTES];
+} bk_t;
+
 typedef struct kp {
 	struct pk pk;
 	struct sk sk;
@@ -29,6 +34,39 @@ typedef struct hdr {
 	uint8_t hdr[NONCE_LENGTH + MAC_LENGTH + KEY_LENGTH];
 } hdr_t;
 
+// versioned streams start with magic, version, flags, log2 of the block size and
+// the number of recipients. streams without it are read as the original format.
+#define MAGIC        "nenc"
+#define MAGIC_LENGTH (4)
+#define VERSION      (1)
+#define PRE_LENGTH   (MAGIC_LENGTH + 4)
+typedef struct pre {
+	uint8_t pre[PRE_LENGTH];
+} pre_t;
+
+// the stream ends with a sealed footer
+#define FLAG_FOOTER  (1 << 0)
+// blocks of any length, each one behind a frame header
+#define FLAG_FRAMED  (1 << 1)
+// the whole message is boxed right behind the preamble. there are no blocks.
+#define FLAG_COMPACT (1 << 2)
+// framed blocks may be packed with lz_pack. all but the final one hold a full block.
+#define FLAG_PACKED  (1 << 3)
+// every block carries its own salt and can be sealed again in place
+#define FLAG_UPDATABLE (1 << 4)
+// the plaintext is files one after another, their index and the length of the index
+#define FLAG_ARCHIVE   (1 << 5)
+
+// inputs up to this size are sent compact: nonce, MAC, the preamble again and the data
+#define COMPACT_MAX       (1024)
+#define COMPACT_LENGTH(n) (NONCE_LENGTH + MAC_LENGTH + PRE_LENGTH + (n))
+
+// the data key boxed for one recipient together with the preamble it belongs to
+#define WRAP_LENGTH (NONCE_LENGTH + MAC_LENGTH + KEY_LENGTH + PRE_LENGTH)
+typedef struct wrap {
+	uint8_t wrap[WRAP_LENGTH];
+} wrap_t;
+
 typedef struct hex_pk {
 	char hex_pk[2 * crypto_box_PUBLICKEYBYTES + sizeof('\0')];
 } hex_pk_t;
@@ -51,16 +89,57 @@ typedef enum op {
 	LIST_KEYS,
 	ENCRYPT,
 	DECRYPT,
+	INSPECT,
+	VERIFY,
+	REWRAP,
+	UPDATE,
+	FORGET,
+	QUERY,
 } op_t;
 
+// chunks of a snapshot are named by a keyed hash of their plaintext
+#define CHUNK_ID_LENGTH (32)
+
+// a message names up to this many recipients. the count is a byte in the preamble.
+#define MAX_RECIPIENTS (255)
+
 typedef struct opts {
 	enum op     op;
 	const char *target;
+	const char *targets[MAX_RECIPIENTS];
+	unsigned    n_targets;
+	const char *new_source;
+	const char *new_targets[MAX_RECIPIENTS];
+	unsigned    n_new_targets;
 	const char *source;
 	const char *name;
+	const char *input;
+	const char *output;
+	const char *append;
+	const char *checkpoint;
+	const char *update;
+	const char *member;
+	const char *snapshot;
+	const char *query;
+	char *const *files;
+	unsigned    n_files;
+	unsigned    jobs;
+	unsigned    depth;
+	size_t      block_size;
+	unsigned    latency;
+	size_t      flush;
+	uint64_t    offset;
+	uint64_t    length;
 	unsigned    force       : 1;
 	unsigned    use_public  : 1;
 	unsigned    use_private : 1;
+	unsigned    zero_copy   : 1;
+	unsigned    footer      : 1;
+	unsigned    pack        : 1;
+	unsigned    resume      : 1;
+	unsigned    updatable   : 1;
+	unsigned    archive     : 1;
+	unsigned    records     : 1;
 } opts_t;
 
 typedef enum rc {
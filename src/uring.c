@@ -0,0 +1,193 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "uring.h"
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+static int queue(struct uring *u, uint8_t op, int fd, const void *buf, size_t len, uint64_t off, uint64_t tag);
+
+int uring_init(struct uring *u, unsigned entries) {
+	struct io_uring_params p;
+	uint8_t               *sq;
+	uint8_t               *cq;
+
+	memset(u, 0, sizeof(*u));
+	memset(&p, 0, sizeof(p));
+	if ( (u->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0 )
+		return -1;
+
+	u->entries  = p.sq_entries;
+	u->sq_len   = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cq_len   = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	if ( p.features & IORING_FEAT_SINGLE_MMAP ) {
+		if ( u->cq_len > u->sq_len )
+			u->sq_len = u->cq_len;
+		u->cq_len = 0;
+	}
+
+	u->sq_map = mmap(NULL, u->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if ( u->sq_map == MAP_FAILED )
+		goto close;
+
+	u->cq_map = u->sq_map;
+	if ( u->cq_len ) {
+		u->cq_map = mmap(NULL, u->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+		if ( u->cq_map == MAP_FAILED )
+			goto sq;
+	}
+
+	u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if ( u->sqes == MAP_FAILED )
+		goto cq;
+
+	sq = u->sq_map;
+	cq = u->cq_map;
+	u->sq_head  = (unsigned *) (sq + p.sq_off.head);
+	u->sq_tail  = (unsigned *) (sq + p.sq_off.tail);
+	u->sq_mask  = (unsigned *) (sq + p.sq_off.ring_mask);
+	u->sq_array = (unsigned *) (sq + p.sq_off.array);
+	u->cq_head  = (unsigned *) (cq + p.cq_off.head);
+	u->cq_tail  = (unsigned *) (cq + p.cq_off.tail);
+	u->cq_mask  = (unsigned *) (cq + p.cq_off.ring_mask);
+	u->cqes     = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+	return 0;
+
+cq:
+	if ( u->cq_len )
+		munmap(u->cq_map, u->cq_len);
+sq:
+	munmap(u->sq_map, u->sq_len);
+close:
+	close(u->fd);
+	return -1;
+}
+
+void uring_free(struct uring *u) {
+	munmap(u->sqes, u->sqes_len);
+	if ( u->cq_len )
+		munmap(u->cq_map, u->cq_len);
+	munmap(u->sq_map, u->sq_len);
+	close(u->fd);
+}
+
+// pin buf once instead of mapping the pages again for every request. failure is not fatal.
+int uring_register(struct uring *u, const void *buf, size_t len) {
+	struct iovec iov = { .iov_base = (void *) buf, .iov_len = len };
+
+	if ( syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_BUFFERS, &iov, 1) )
+		return -1;
+
+	u->fixed     = buf;
+	u->fixed_len = len;
+	return 0;
+}
+
+int uring_read(struct uring *u, int fd, void *buf, size_t len, uint64_t off, uint64_t tag) {
+	return queue(u, IORING_OP_READ_FIXED, fd, buf, len, off, tag);
+}
+
+int uring_write(struct uring *u, int fd, const void *buf, size_t len, uint64_t off, uint64_t tag) {
+	return queue(u, IORING_OP_WRITE_FIXED, fd, buf, len, off, tag);
+}
+
+// submit everything queued and block until at least min requests completed
+int uring_wait(struct uring *u, unsigned min) {
+	long r;
+
+	if ( !u->queued && !min )
+		return 0;
+
+	while ( (r = syscall(__NR_io_uring_enter, u->fd, u->queued, min, min ? IORING_ENTER_GETEVENTS : 0, NULL, 0)) < 0 ) {
+		if ( errno != EINTR )
+			return -1;
+	}
+
+	u->queued -= r;
+	return 0;
+}
+
+bool uring_reap(struct uring *u, uint64_t *tag, int32_t *res) {
+	unsigned head = *u->cq_head;
+
+	if ( head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE) )
+		return false;
+
+	struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+	*tag = cqe->user_data;
+	*res = cqe->res;
+	__atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+static int queue(struct uring *u, uint8_t op, int fd, const void *buf, size_t len, uint64_t off, uint64_t tag) {
+	unsigned tail = *u->sq_tail;
+
+	if ( tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) == u->entries )
+		return -1;
+
+	// buffers outside the registered region take the plain opcodes
+	const uint8_t *p = buf;
+	bool fixed = u->fixed && p >= u->fixed && p + len <= u->fixed + u->fixed_len;
+	if ( !fixed )
+		op = op == IORING_OP_READ_FIXED ? IORING_OP_READ : IORING_OP_WRITE;
+
+	unsigned             idx = tail & *u->sq_mask;
+	struct io_uring_sqe *sqe = &u->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode    = op;
+	sqe->fd        = fd;
+	sqe->addr      = (uintptr_t) buf;
+	sqe->len       = len;
+	sqe->off       = off;
+	sqe->buf_index = 0;
+	sqe->user_data = tag;
+	u->sq_array[idx] = idx;
+
+	__atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	u->queued++;
+
+	return 0;
+}
+#else
+int uring_init(struct uring *u, unsigned entries) {
+	memset(u, 0, sizeof(*u));
+	errno = ENOSYS;
+	return -1;
+}
+
+void uring_free(struct uring *u) {
+}
+
+int uring_register(struct uring *u, const void *buf, size_t len) {
+	return -1;
+}
+
+int uring_read(struct uring *u, int fd, void *buf, size_t len, uint64_t off, uint64_t tag) {
+	return -1;
+}
+
+int uring_write(struct uring *u, int fd, const void *buf, size_t len, uint64_t off, uint64_t tag) {
+	return -1;
+}
+
+int uring_wait(struct uring *u, unsigned min) {
+	return -1;
+}
+
+bool uring_reap(struct uring *u, uint64_t *tag, int32_t *res) {
+	return false;
+}
+#endif
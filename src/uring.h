@@ -0,0 +1,39 @@
+#ifndef _NACL_CRYPT_URING_H
+#define _NACL_CRYPT_URING_H
+
+#include "types.h"
+
+// minimal io_uring(7) on raw system calls. one instance belongs to a single thread.
+// buffers inside the registered region are read and written as fixed buffers.
+typedef struct uring {
+	int                 fd;
+	unsigned            entries;
+	unsigned            queued;
+	unsigned           *sq_head;
+	unsigned           *sq_tail;
+	unsigned           *sq_mask;
+	unsigned           *sq_array;
+	unsigned           *cq_head;
+	unsigned           *cq_tail;
+	unsigned           *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void               *sq_map;
+	void               *cq_map;
+	size_t              sq_len;
+	size_t              cq_len;
+	size_t              sqes_len;
+	const uint8_t      *fixed;
+	size_t              fixed_len;
+} uring_t;
+
+// returns -1 if the kernel has no io_uring. callers fall back to read(2) and write(2).
+int  uring_init(struct uring *u, unsigned entries);
+void uring_free(struct uring *u);
+int  uring_register(struct uring *u, const void *buf, size_t len);
+int  uring_read(struct uring *u, int fd, void *buf, size_t len, uint64_t off, uint64_t tag);
+int  uring_write(struct uring *u, int fd, const void *buf, size_t len, uint64_t off, uint64_t tag);
+int  uring_wait(struct uring *u, unsigned min);
+bool uring_reap(struct uring *u, uint64_t *tag, int32_t *res);
+
+#endif /* _NACL_CRYPT_URING_H */
@@ -0,0 +1,572 @@
+#include "vfs.h"
+#include "hdr.h"
+#include "stream.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <crypto_secretbox.h>
+#include <sqlite3.h>
+
+// what a sealed block carries on top of its plaintext
+#define OVER (SALT_LENGTH + MAC_LENGTH)
+
+// the room in front of f->m the box needs. the page itself is at f->m + ROOM.
+#define ROOM (crypto_secretbox_ZEROBYTES)
+
+typedef struct vfs {
+	sqlite3_vfs  base;
+	sqlite3_vfs *real;
+	struct bk    bk;
+	size_t       bs;
+} vfs_t;
+
+// the file of the underlying VFS follows right behind. head is the length of the
+// header and stays 0 until one was read or written. journals and logs are lenient,
+// a database is paged: every block holds one page of it. m and c are laid out for
+// crypto_secretbox(), a block is sealed and opened in place between them.
+typedef struct file {
+	sqlite3_file  base;
+	sqlite3_file *real;
+	struct vfs   *vfs;
+	uint8_t       k[KEY_LENGTH];
+	uint64_t      head;
+	size_t        bs;
+	uint8_t      *m;
+	uint8_t      *c;
+	bool          lenient;
+	bool          paged;
+} file_t;
+
+static int load_head(struct file *f);
+static int make_head(struct file *f, size_t bs);
+static int get_length(struct file *f, uint64_t *len);
+static int get_block(struct file *f, uint64_t i, size_t n);
+static int put_block(struct file *f, uint64_t i, size_t n);
+
+static int file_close(sqlite3_file *file);
+static int file_read(sqlite3_file *file, void *buf, int amt, sqlite3_int64 off);
+static int file_write(sqlite3_file *file, const void *buf, int amt, sqlite3_int64 off);
+static int file_truncate(sqlite3_file *file, sqlite3_int64 size);
+static int file_sync(sqlite3_file *file, int flags);
+static int file_size(sqlite3_file *file, sqlite3_int64 *size);
+static int file_lock(sqlite3_file *file, int lock);
+static int file_unlock(sqlite3_file *file, int lock);
+static int file_reserved(sqlite3_file *file, int *out);
+static int file_control(sqlite3_file *file, int op, void *arg);
+static int file_sector(sqlite3_file *file);
+static int file_device(sqlite3_file *file);
+static int file_shm_map(sqlite3_file *file, int region, int size, int extend, void volatile **p);
+static int file_shm_lock(sqlite3_file *file, int off, int n, int flags);
+static void file_shm_barrier(sqlite3_file *file);
+static int file_shm_unmap(sqlite3_file *file, int delete);
+
+static int vfs_open(sqlite3_vfs *v, const char *name, sqlite3_file *file, int flags, int *out);
+static int vfs_delete(sqlite3_vfs *v, const char *name, int sync);
+static int vfs_access(sqlite3_vfs *v, const char *name, int flags, int *out);
+static int vfs_full(sqlite3_vfs *v, const char *name, int n, char *out);
+static void *vfs_dl_open(sqlite3_vfs *v, const char *name);
+static void vfs_dl_error(sqlite3_vfs *v, int n, char *msg);
+static void (*vfs_dl_sym(sqlite3_vfs *v, void *h, const char *sym))(void);
+static void vfs_dl_close(sqlite3_vfs *v, void *h);
+static int vfs_random(sqlite3_vfs *v, int n, char *out);
+static int vfs_sleep(sqlite3_vfs *v, int us);
+static int vfs_time(sqlite3_vfs *v, double *now);
+static int vfs_error(sqlite3_vfs *v, int n, char *msg);
+static int vfs_time64(sqlite3_vfs *v, sqlite3_int64 *now);
+
+static const sqlite3_io_methods methods = {
+	.iVersion               = 2,
+	.xClose                 = file_close,
+	.xRead                  = file_read,
+	.xWrite                 = file_write,
+	.xTruncate              = file_truncate,
+	.xSync                  = file_sync,
+	.xFileSize              = file_size,
+	.xLock                  = file_lock,
+	.xUnlock                = file_unlock,
+	.xCheckReservedLock     = file_reserved,
+	.xFileControl           = file_control,
+	.xSectorSize            = file_sector,
+	.xDeviceCharacteristics = file_device,
+	.xShmMap                = file_shm_map,
+	.xShmLock               = file_shm_lock,
+	.xShmBarrier            = file_shm_barrier,
+	.xShmUnmap              = file_shm_unmap
+};
+
+int register_vfs(const char *name, const struct pk *pk, const struct sk *sk, size_t bs) {
+	sqlite3_vfs *real;
+	struct vfs  *v;
+
+	if ( !(real = sqlite3_vfs_find(NULL)) )
+		return SQLITE_ERROR;
+
+	// SQLite keeps the VFS until the process ends
+	if ( !(v = calloc(1, sizeof(*v))) )
+		return SQLITE_NOMEM;
+
+	if ( box_key(&v->bk, pk, sk) ) {
+		free(v);
+		return SQLITE_ERROR;
+	}
+
+	v->real                   = real;
+	v->bs                     = bs;
+	v->base.iVersion          = real->iVersion < 2 ? 1 : 2;
+	v->base.szOsFile          = sizeof(struct file) + real->szOsFile;
+	v->base.mxPathname        = real->mxPathname;
+	v->base.zName             = name;
+	v->base.xOpen             = vfs_open;
+	v->base.xDelete           = vfs_delete;
+	v->base.xAccess           = vfs_access;
+	v->base.xFullPathname     = vfs_full;
+	v->base.xDlOpen           = vfs_dl_open;
+	v->base.xDlError          = vfs_dl_error;
+	v->base.xDlSym            = vfs_dl_sym;
+	v->base.xDlClose          = vfs_dl_close;
+	v->base.xRandomness       = vfs_random;
+	v->base.xSleep            = vfs_sleep;
+	v->base.xCurrentTime      = vfs_time;
+	v->base.xGetLastError     = vfs_error;
+	v->base.xCurrentTimeInt64 = vfs_time64;
+
+	return sqlite3_vfs_register(&v->base, 0);
+}
+
+// read the header of a file that has one. ours is any of its recipients.
+static int load_head(struct file *f) {
+	sqlite3_file  *r = f->real;
+	sqlite3_int64  size;
+	struct pre     pre;
+	struct wrap    wrap;
+	bool           found = false;
+	int            rc;
+
+	if ( f->head )
+		return SQLITE_OK;
+
+	// nothing was written yet. the header goes in with the first write.
+	if ( (rc = r->pMethods->xFileSize(r, &size)) || size == 0 )
+		return rc;
+
+	if ( (rc = r->pMethods->xRead(r, pre.pre, PRE_LENGTH, 0)) )
+		return rc == SQLITE_IOERR_SHORT_READ ? SQLITE_NOTADB : rc;
+
+	if ( !is_pre(&pre) || PRE_VERSION(&pre) != VERSION || PRE_FLAGS(&pre) != FLAG_UPDATABLE || PRE_RECIPIENTS(&pre) == 0 )
+		return SQLITE_NOTADB;
+
+	if ( PRE_LOG_BS(&pre) >= sizeof(size_t) * 8 || ((size_t) 1 << PRE_LOG_BS(&pre)) < MIN_BS || ((size_t) 1 << PRE_LOG_BS(&pre)) > MAX_BS )
+		return SQLITE_NOTADB;
+
+	for ( unsigned i = 0; !found && i < PRE_RECIPIENTS(&pre); i++ ) {
+		if ( (rc = r->pMethods->xRead(r, wrap.wrap, WRAP_LENGTH, PRE_LENGTH + i * WRAP_LENGTH)) )
+			return rc == SQLITE_IOERR_SHORT_READ ? SQLITE_NOTADB : rc;
+		found = unwrap_key_bk(f->k, &wrap, &pre, &f->vfs->bk) == 0;
+	}
+
+	if ( !found )
+		return SQLITE_NOTADB;
+
+	f->bs = (size_t) 1 << PRE_LOG_BS(&pre);
+	if ( !(f->m = malloc(ROOM + f->bs)) || !(f->c = malloc(f->bs + OVER)) )
+		return SQLITE_NOMEM;
+
+	f->head = PRE_LENGTH + (uint64_t) PRE_RECIPIENTS(&pre) * WRAP_LENGTH;
+	return SQLITE_OK;
+}
+
+// a new file is the header for a fresh key and one empty block. both go in with one write.
+static int make_head(struct file *f, size_t bs) {
+	sqlite3_file *r = f->real;
+	struct pre    pre;
+	struct wrap   wrap;
+	uint8_t       head[PRE_LENGTH + WRAP_LENGTH + OVER];
+	unsigned      log_bs = 0;
+	int           rc;
+
+	while ( ((size_t) 1 << log_bs) < bs )
+		log_bs++;
+
+	init_key(f->k);
+	init_pre(&pre, FLAG_UPDATABLE, log_bs, 1);
+	if ( wrap_key_bk(&wrap, f->k, &pre, &f->vfs->bk) )
+		return SQLITE_IOERR_WRITE;
+	memcpy(head, pre.pre, PRE_LENGTH);
+	memcpy(head + PRE_LENGTH, wrap.wrap, WRAP_LENGTH);
+
+	if ( seal_salted(head + PRE_LENGTH + WRAP_LENGTH, pre.pre, 0, 0, f->k) )
+		return SQLITE_NOMEM;
+
+	f->bs = bs;
+	if ( !(f->m = malloc(ROOM + f->bs)) || !(f->c = malloc(f->bs + OVER)) )
+		return SQLITE_NOMEM;
+
+	if ( (rc = r->pMethods->xWrite(r, head, sizeof(head), 0)) )
+		return rc;
+
+	f->head = PRE_LENGTH + WRAP_LENGTH;
+	return SQLITE_OK;
+}
+
+// full blocks, then a short final one. its length gives away the length of the file.
+static int get_length(struct file *f, uint64_t *len) {
+	sqlite3_int64 size;
+	uint64_t      bl = f->bs + OVER;
+	uint64_t      data;
+	int           rc;
+
+	if ( !f->head ) {
+		*len = 0;
+		return SQLITE_OK;
+	}
+
+	if ( (rc = f->real->pMethods->xFileSize(f->real, &size)) )
+		return rc;
+
+	if ( (uint64_t) size < f->head + OVER || (size - f->head - OVER) % bl >= f->bs )
+		return SQLITE_CORRUPT;
+
+	data = size - f->head - OVER;
+	*len = data / bl * f->bs + data % bl;
+	return SQLITE_OK;
+}
+
+// open block i of n bytes into f->m + ROOM. a write cut short by a crash leaves a block that
+// doesn't open. in a journal or a log it reads as zeroes, their checksums reject it.
+static int get_block(struct file *f, uint64_t i, size_t n) {
+	int rc;
+
+	if ( (rc = f->real->pMethods->xRead(f->real, f->c, n + OVER, f->head + i * (f->bs + OVER))) )
+		return rc == SQLITE_IOERR_SHORT_READ ? SQLITE_CORRUPT : rc;
+
+	if ( open_salted_box(f->m, f->c, n + OVER, i, f->k) ) {
+		if ( !f->lenient )
+			return SQLITE_CORRUPT;
+		memset(f->m + ROOM, 0, n);
+	}
+
+	return SQLITE_OK;
+}
+
+// seal n bytes of f->m + ROOM as block i under a new salt
+static int put_block(struct file *f, uint64_t i, size_t n) {
+	if ( seal_salted_box(f->c, f->m, n, i, f->k) )
+		return SQLITE_IOERR_WRITE;
+
+	return f->real->pMethods->xWrite(f->real, f->c, n + OVER, f->head + i * (f->bs + OVER));
+}
+
+static int file_close(sqlite3_file *file) {
+	struct file *f  = (struct file *) file;
+	int          rc = f->real->pMethods->xClose(f->real);
+
+	memset(f->k, 0, sizeof(f->k));
+	free(f->m);
+	free(f->c);
+	return rc;
+}
+
+// only the blocks under the range are opened. SQLite wants the rest of a short read zeroed.
+static int file_read(sqlite3_file *file, void *buf, int amt, sqlite3_int64 off) {
+	struct file *f = (struct file *) file;
+	uint8_t     *p = buf;
+	uint64_t     len;
+	int          rc;
+
+	if ( (rc = load_head(f)) || (rc = get_length(f, &len)) )
+		return rc;
+
+	while ( amt > 0 && (uint64_t) off < len ) {
+		uint64_t i  = off / f->bs;
+		size_t   at = off % f->bs;
+		size_t   n  = len - i * f->bs < f->bs ? len - i * f->bs : f->bs;
+		size_t   c  = n - at < (size_t) amt ? n - at : (size_t) amt;
+
+		if ( (rc = get_block(f, i, n)) )
+			return rc;
+
+		memcpy(p, f->m + ROOM + at, c);
+		p   += c;
+		off += c;
+		amt -= c;
+	}
+
+	if ( amt > 0 ) {
+		memset(p, 0, amt);
+		return SQLITE_IOERR_SHORT_READ;
+	}
+	return SQLITE_OK;
+}
+
+// a block only partly written is opened and sealed again. writes behind the end fill
+// the gap with zeroes. a database is written a page at a time and every page is a block
+// of its own, so rolling back a journal never opens a block a crash left broken.
+static int file_write(sqlite3_file *file, const void *buf, int amt, sqlite3_int64 off) {
+	struct file *f = (struct file *) file;
+	uint64_t     len;
+	uint64_t     end;
+	uint64_t     first;
+	uint64_t     last;
+	int          rc;
+
+	if ( amt <= 0 )
+		return SQLITE_OK;
+
+	if ( (rc = load_head(f)) )
+		return rc;
+
+	// a new database takes the length of its pages for its blocks
+	if ( !f->head ) {
+		if ( f->paged && (amt < MIN_BS || amt > VFS_MAX_BS || (amt & (amt - 1))) )
+			return SQLITE_IOERR_WRITE;
+		if ( (rc = make_head(f, f->paged ? (size_t) amt : f->vfs->bs)) )
+			return rc;
+	}
+
+	if ( f->paged && ((uint64_t) off % f->bs || (size_t) amt != f->bs) )
+		return SQLITE_IOERR_WRITE;
+
+	if ( (rc = get_length(f, &len)) )
+		return rc;
+
+	end   = (uint64_t) off + amt;
+	first = ((uint64_t) off < len ? (uint64_t) off : len) / f->bs;
+	last  = end > len ? end / f->bs : (end - 1) / f->bs;
+	if ( end < len )
+		end = len;
+
+	// the final block goes first. it fixes the length of the file, a crash after it
+	// leaves a broken block in front of it and never a file of the wrong shape.
+	for ( uint64_t i = last + 1; i-- > first; ) {
+		uint64_t start = i * f->bs;
+		size_t   n     = end - start < f->bs ? end - start : f->bs;
+		size_t   old   = 0;
+		uint64_t from  = start > (uint64_t) off ? start : (uint64_t) off;
+		uint64_t to    = start + n < (uint64_t) off + amt ? start + n : (uint64_t) off + amt;
+
+		if ( start < len && (start < (uint64_t) off || start + n > (uint64_t) off + amt) ) {
+			old = len - start < f->bs ? len - start : f->bs;
+			if ( (rc = get_block(f, i, old)) )
+				return rc;
+		}
+
+		if ( n > old )
+			memset(f->m + ROOM + old, 0, n - old);
+		if ( from < to )
+			memcpy(f->m + ROOM + (from - start), (const uint8_t *) buf + (from - off), to - from);
+
+		if ( (rc = put_block(f, i, n)) )
+			return rc;
+	}
+
+	return SQLITE_OK;
+}
+
+// the block the new end falls into becomes the final one. the file is cut first, a crash
+// in between leaves just that block broken.
+static int file_truncate(sqlite3_file *file, sqlite3_int64 size) {
+	struct file *f = (struct file *) file;
+	uint64_t     len;
+	uint64_t     i;
+	size_t       n;
+	int          rc;
+
+	if ( (rc = load_head(f)) || (rc = get_length(f, &len)) )
+		return rc;
+
+	// SQLite grows files by writing to them
+	if ( !f->head || (uint64_t) size >= len )
+		return SQLITE_OK;
+
+	i = size / f->bs;
+	n = size % f->bs;
+	if ( n && (rc = get_block(f, i, len - i * f->bs < f->bs ? len - i * f->bs : f->bs)) )
+		return rc;
+
+	if ( (rc = f->real->pMethods->xTruncate(f->real, f->head + i * (f->bs + OVER) + n + OVER)) )
+		return rc;
+
+	return put_block(f, i, n);
+}
+
+static int file_sync(sqlite3_file *file, int flags) {
+	struct file *f = (struct file *) file;
+
+	return f->real->pMethods->xSync(f->real, flags);
+}
+
+static int file_size(sqlite3_file *file, sqlite3_int64 *size) {
+	struct file *f = (struct file *) file;
+	uint64_t     len;
+	int          rc;
+
+	if ( (rc = load_head(f)) || (rc = get_length(f, &len)) )
+		return rc;
+
+	*size = len;
+	return SQLITE_OK;
+}
+
+static int file_lock(sqlite3_file *file, int lock) {
+	struct file *f = (struct file *) file;
+
+	return f->real->pMethods->xLock(f->real, lock);
+}
+
+static int file_unlock(sqlite3_file *file, int lock) {
+	struct file *f = (struct file *) file;
+
+	return f->real->pMethods->xUnlock(f->real, lock);
+}
+
+static int file_reserved(sqlite3_file *file, int *out) {
+	struct file *f = (struct file *) file;
+
+	return f->real->pMethods->xCheckReservedLock(f->real, out);
+}
+
+// hints would grow the file underneath without blocks
+static int file_control(sqlite3_file *file, int op, void *arg) {
+	struct file *f = (struct file *) file;
+
+	if ( op == SQLITE_FCNTL_SIZE_HINT || op == SQLITE_FCNTL_CHUNK_SIZE )
+		return SQLITE_OK;
+
+	return f->real->pMethods->xFileControl(f->real, op, arg);
+}
+
+// a write may tear the whole block it falls into. with a block as the sector SQLite
+// starts the journal anew and pads the log behind every sync where the next block begins.
+static int file_sector(sqlite3_file *file) {
+	struct file *f = (struct file *) file;
+
+	return f->head ? f->bs : f->vfs->bs;
+}
+
+static int file_device(sqlite3_file *file) {
+	(void) file;
+	return 0;
+}
+
+static int file_shm_map(sqlite3_file *file, int region, int size, int extend, void volatile **p) {
+	struct file *f = (struct file *) file;
+
+	return f->real->pMethods->xShmMap(f->real, region, size, extend, p);
+}
+
+static int file_shm_lock(sqlite3_file *file, int off, int n, int flags) {
+	struct file *f = (struct file *) file;
+
+	return f->real->pMethods->xShmLock(f->real, off, n, flags);
+}
+
+static void file_shm_barrier(sqlite3_file *file) {
+	struct file *f = (struct file *) file;
+
+	f->real->pMethods->xShmBarrier(f->real);
+}
+
+static int file_shm_unmap(sqlite3_file *file, int delete) {
+	struct file *f = (struct file *) file;
+
+	return f->real->pMethods->xShmUnmap(f->real, delete);
+}
+
+// databases, journals, logs and temporary files alike. the index of a log in shared
+// memory holds no content and stays with the underlying VFS.
+static int vfs_open(sqlite3_vfs *v, const char *name, sqlite3_file *file, int flags, int *out) {
+	struct vfs  *vfs = (struct vfs *) v;
+	struct file *f   = (struct file *) file;
+	int          rc;
+
+	memset(f, 0, sizeof(*f));
+	f->real    = (sqlite3_file *) (f + 1);
+	f->vfs     = vfs;
+	f->lenient = !(flags & (SQLITE_OPEN_MAIN_DB | SQLITE_OPEN_TEMP_DB));
+	f->paged   = flags & SQLITE_OPEN_MAIN_DB;
+
+	if ( (rc = vfs->real->xOpen(vfs->real, name, f->real, flags, out)) )
+		return rc;
+
+	// without shared memory underneath there is no log either
+	if ( f->real->pMethods->iVersion < 2 ) {
+		f->real->pMethods->xClose(f->real);
+		return SQLITE_CANTOPEN;
+	}
+
+	f->base.pMethods = &methods;
+	return SQLITE_OK;
+}
+
+static int vfs_delete(sqlite3_vfs *v, const char *name, int sync) {
+	sqlite3_vfs *real = ((struct vfs *) v)->real;
+
+	return real->xDelete(real, name, sync);
+}
+
+static int vfs_access(sqlite3_vfs *v, const char *name, int flags, int *out) {
+	sqlite3_vfs *real = ((struct vfs *) v)->real;
+
+	return real->xAccess(real, name, flags, out);
+}
+
+static int vfs_full(sqlite3_vfs *v, const char *name, int n, char *out) {
+	sqlite3_vfs *real = ((struct vfs *) v)->real;
+
+	return real->xFullPathname(real, name, n, out);
+}
+
+static void *vfs_dl_open(sqlite3_vfs *v, const char *name) {
+	sqlite3_vfs *real = ((struct vfs *) v)->real;
+
+	return real->xDlOpen(real, name);
+}
+
+static void vfs_dl_error(sqlite3_vfs *v, int n, char *msg) {
+	sqlite3_vfs *real = ((struct vfs *) v)->real;
+
+	real->xDlError(real, n, msg);
+}
+
+static void (*vfs_dl_sym(sqlite3_vfs *v, void *h, const char *sym))(void) {
+	sqlite3_vfs *real = ((struct vfs *) v)->real;
+
+	return real->xDlSym(real, h, sym);
+}
+
+static void vfs_dl_close(sqlite3_vfs *v, void *h) {
+	sqlite3_vfs *real = ((struct vfs *) v)->real;
+
+	real->xDlClose(real, h);
+}
+
+static int vfs_random(sqlite3_vfs *v, int n, char *out) {
+	sqlite3_vfs *real = ((struct vfs *) v)->real;
+
+	return real->xRandomness(real, n, out);
+}
+
+static int vfs_sleep(sqlite3_vfs *v, int us) {
+	sqlite3_vfs *real = ((struct vfs *) v)->real;
+
+	return real->xSleep(real, us);
+}
+
+static int vfs_time(sqlite3_vfs *v, double *now) {
+	sqlite3_vfs *real = ((struct vfs *) v)->real;
+
+	return real->xCurrentTime(real, now);
+}
+
+static int vfs_error(sqlite3_vfs *v, int n, char *msg) {
+	sqlite3_vfs *real = ((struct vfs *) v)->real;
+
+	return real->xGetLastError ? real->xGetLastError(real, n, msg) : 0;
+}
+
+static int vfs_time64(sqlite3_vfs *v, sqlite3_int64 *now) {
+	sqlite3_vfs *real = ((struct vfs *) v)->real;
+
+	return real->xCurrentTimeInt64(real, now);
+}
@@ -0,0 +1,21 @@
+#ifndef _NACL_CRYPT_VFS_H
+#define _NACL_CRYPT_VFS_H
+
+#include "types.h"
+
+// a SQLite VFS on top of the default one. every file it opens is an updatable message
+// from sk to pk: the header, then blocks that are sealed one at a time under a salt of
+// their own. a page is read and written without touching any other, nenc -d opens
+// such a file whole and nenc -e -U -b <page size> turns a plain database into one.
+#define VFS_NAME   "nenc"
+#define VFS_BS     (4096)
+
+// a block is a sector to SQLite. it takes no sectors above 64k.
+#define VFS_MAX_BS (65536)
+
+// register the VFS under name. a database has one page in every block, its page size
+// has to be a block size up to VFS_MAX_BS. journals and logs are cut into blocks of bs
+// bytes. returns a SQLite result code.
+int register_vfs(const char *name, const struct pk *pk, const struct sk *sk, size_t bs);
+
+#endif /* _NACL_CRYPT_VFS_H */